@@ -0,0 +1,52 @@
+#include "emitters.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace godot;
+
+EmitterSet::Area EmitterSet::box(const Rect2i &bounds)
+{
+  Area a;
+  a.bounds = bounds;
+  return a;
+}
+
+EmitterSet::Area EmitterSet::circle(const Vector2 &center, float radius)
+{
+  Area a;
+  a.center = center;
+  a.radius = std::max(radius, 0.5f);
+  int r = (int)std::ceil(a.radius);
+  a.bounds = Rect2i((int)std::floor(center.x) - r, (int)std::floor(center.y) - r, r * 2 + 1, r * 2 + 1);
+  return a;
+}
+
+int EmitterSet::add_emitter(const Emitter &emitter)
+{
+  emitters.push_back(emitter);
+  liveEmitters++;
+  return (int)emitters.size() - 1;
+}
+
+int EmitterSet::add_drain(const Drain &drain)
+{
+  drains.push_back(drain);
+  liveDrains++;
+  return (int)drains.size() - 1;
+}
+
+void EmitterSet::remove_emitter(int id)
+{
+  if (!is_valid_emitter(id))
+    return;
+  emitters[id].alive = false;
+  liveEmitters--;
+}
+
+void EmitterSet::remove_drain(int id)
+{
+  if (!is_valid_drain(id))
+    return;
+  drains[id].alive = false;
+  liveDrains--;
+}
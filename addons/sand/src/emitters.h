@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <godot_cpp/variant/rect2i.hpp>
+#include <godot_cpp/variant/vector2.hpp>
+
+namespace godot
+{
+
+  // Persistent sources and sinks of material, run by the engine every tick.
+  //
+  // Emitters spawn a material into free cells of their area at a rate in cells per second,
+  // drains remove particles of the materials in their mask once they are inside their area.
+  // Both are a box, optionally cut down to the circle inside it.
+  class EmitterSet
+  {
+  public:
+    struct Area
+    {
+      Rect2i bounds;
+      Vector2 center;
+      float radius = 0.0f; // 0 for the whole box
+
+      bool contains(int x, int y) const
+      {
+        if (x < bounds.position.x || y < bounds.position.y || x >= bounds.position.x + bounds.size.x || y >= bounds.position.y + bounds.size.y)
+          return false;
+        return radius <= 0.0f || (Vector2(x + 0.5f, y + 0.5f) - center).length_squared() <= radius * radius;
+      }
+    };
+
+    struct Emitter
+    {
+      Area area;
+      uint32_t material = 0;
+      float rate = 0.0f; // cells per second
+      Vector2 velocity;  // initial velocity of spawned particles
+      bool enabled = true;
+      bool alive = true;
+      float pending = 0.0f; // fraction of a cell carried over to the next tick
+      int64_t spawned = 0;
+      int64_t blocked = 0; // spawns that found no free cell or hit the particle limit
+    };
+
+    struct Drain
+    {
+      Area area;
+      uint32_t materialMask = 0; // bit per material
+      bool enabled = true;
+      bool alive = true;
+      int64_t removed = 0;
+    };
+
+    static Area box(const Rect2i &bounds);
+    static Area circle(const Vector2 &center, float radius);
+
+    int add_emitter(const Emitter &emitter);
+    int add_drain(const Drain &drain);
+    void remove_emitter(int id);
+    void remove_drain(int id);
+    bool is_valid_emitter(int id) const { return id >= 0 && id < (int)emitters.size() && emitters[id].alive; }
+    bool is_valid_drain(int id) const { return id >= 0 && id < (int)drains.size() && drains[id].alive; }
+
+    bool empty() const { return liveEmitters == 0 && liveDrains == 0; }
+
+    std::vector<Emitter> emitters;
+    std::vector<Drain> drains;
+
+  private:
+    int liveEmitters = 0;
+    int liveDrains = 0;
+  };
+
+} // namespace godot
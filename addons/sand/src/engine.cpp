@@ -10,7 +10,17 @@
 #include <godot_cpp/classes/collision_shape2d.hpp>
 #include <godot_cpp/classes/shape2d.hpp>
 #include <godot_cpp/classes/rectangle_shape2d.hpp>
+#include <godot_cpp/classes/worker_thread_pool.hpp>
+#include <godot_cpp/classes/geometry2d.hpp>
+#include <godot_cpp/classes/bit_map.hpp>
+#include <godot_cpp/classes/image.hpp>
+#include <godot_cpp/classes/image_texture.hpp>
+#include <godot_cpp/classes/sprite2d.hpp>
+#include <godot_cpp/classes/collision_polygon2d.hpp>
 #include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <new>
 #include <random>
 
 // rand
@@ -22,15 +32,158 @@
 
 using namespace godot;
 
+// storage for one particle of any type, particles are placement-new'd into these slots
+static const size_t PARTICLE_SLOT_SIZE = ((MAX(sizeof(Sand), sizeof(Water)) + alignof(std::max_align_t) - 1) / alignof(std::max_align_t)) * alignof(std::max_align_t);
+static const int PARTICLE_BLOCK_SIZE = 4096;
+
 void SandEngine::_bind_methods()
 {
   ClassDB::bind_method(D_METHOD("get_ssbo_rid"), &SandEngine::get_ssbo_rid);
   ClassDB::bind_method(D_METHOD("get_grid_width"), &SandEngine::get_grid_width);
   ClassDB::bind_method(D_METHOD("get_grid_height"), &SandEngine::get_grid_height);
+  ClassDB::bind_method(D_METHOD("set_grid_width", "width"), &SandEngine::set_grid_width);
+  ClassDB::bind_method(D_METHOD("set_grid_height", "height"), &SandEngine::set_grid_height);
+  ClassDB::bind_method(D_METHOD("get_max_particles"), &SandEngine::get_max_particles);
+  ClassDB::bind_method(D_METHOD("set_max_particles", "capacity"), &SandEngine::set_max_particles);
+  ClassDB::bind_method(D_METHOD("get_particle_count"), &SandEngine::get_particle_count);
+  ClassDB::bind_method(D_METHOD("get_refused_spawns"), &SandEngine::get_refused_spawns);
+  ClassDB::bind_method(D_METHOD("get_last_tick_updates"), &SandEngine::get_last_tick_updates);
+  ClassDB::bind_method(D_METHOD("set_granular_mode", "mode"), &SandEngine::set_granular_mode);
+  ClassDB::bind_method(D_METHOD("get_granular_mode"), &SandEngine::get_granular_mode);
+  ClassDB::bind_method(D_METHOD("place_grain", "cell"), &SandEngine::place_grain);
+  ClassDB::bind_method(D_METHOD("add_sensor_rect", "rect"), &SandEngine::add_sensor_rect);
+  ClassDB::bind_method(D_METHOD("add_sensor_polygon", "polygon"), &SandEngine::add_sensor_polygon);
+  ClassDB::bind_method(D_METHOD("remove_sensor", "id"), &SandEngine::remove_sensor);
+  ClassDB::bind_method(D_METHOD("get_sensor_counts", "id"), &SandEngine::get_sensor_counts);
+  ClassDB::bind_method(D_METHOD("add_wind_zone", "box", "acceleration"), &SandEngine::add_wind_zone);
+  ClassDB::bind_method(D_METHOD("add_vortex", "center", "radius", "strength"), &SandEngine::add_vortex);
+  ClassDB::bind_method(D_METHOD("remove_force_field", "id"), &SandEngine::remove_force_field);
+  ClassDB::bind_method(D_METHOD("add_emitter", "area", "material", "rate", "velocity"), &SandEngine::add_emitter, DEFVAL(Vector2()));
+  ClassDB::bind_method(D_METHOD("add_circle_emitter", "center", "radius", "material", "rate", "velocity"), &SandEngine::add_circle_emitter, DEFVAL(Vector2()));
+  ClassDB::bind_method(D_METHOD("remove_emitter", "id"), &SandEngine::remove_emitter);
+  ClassDB::bind_method(D_METHOD("set_emitter_enabled", "id", "enabled"), &SandEngine::set_emitter_enabled);
+  ClassDB::bind_method(D_METHOD("set_emitter_rate", "id", "rate"), &SandEngine::set_emitter_rate);
+  ClassDB::bind_method(D_METHOD("get_emitter_spawned", "id"), &SandEngine::get_emitter_spawned);
+  ClassDB::bind_method(D_METHOD("get_emitter_blocked", "id"), &SandEngine::get_emitter_blocked);
+  ClassDB::bind_method(D_METHOD("add_drain", "area", "material_mask"), &SandEngine::add_drain, DEFVAL(-1));
+  ClassDB::bind_method(D_METHOD("add_circle_drain", "center", "radius", "material_mask"), &SandEngine::add_circle_drain, DEFVAL(-1));
+  ClassDB::bind_method(D_METHOD("remove_drain", "id"), &SandEngine::remove_drain);
+  ClassDB::bind_method(D_METHOD("set_drain_enabled", "id", "enabled"), &SandEngine::set_drain_enabled);
+  ClassDB::bind_method(D_METHOD("get_drain_removed", "id"), &SandEngine::get_drain_removed);
+  ClassDB::bind_method(D_METHOD("remove_particle", "cell"), &SandEngine::remove_particle);
+  ClassDB::bind_method(D_METHOD("apply_radial_impulse", "center", "radius", "strength", "carve_radius"), &SandEngine::apply_radial_impulse, DEFVAL(0.0f));
+  ClassDB::bind_method(D_METHOD("set_view_rect", "rect"), &SandEngine::set_view_rect);
+  ClassDB::bind_method(D_METHOD("get_view_rect"), &SandEngine::get_view_rect);
+  ClassDB::bind_method(D_METHOD("set_lod_enabled", "enabled"), &SandEngine::set_lod_enabled);
+  ClassDB::bind_method(D_METHOD("get_lod_enabled"), &SandEngine::get_lod_enabled);
+  ClassDB::bind_method(D_METHOD("set_lod_margin", "margin"), &SandEngine::set_lod_margin);
+  ClassDB::bind_method(D_METHOD("get_lod_margin"), &SandEngine::get_lod_margin);
+  ClassDB::bind_method(D_METHOD("set_lod_far_interval", "interval"), &SandEngine::set_lod_far_interval);
+  ClassDB::bind_method(D_METHOD("get_lod_far_interval"), &SandEngine::get_lod_far_interval);
+  ClassDB::bind_method(D_METHOD("set_lod_freeze_distance", "distance"), &SandEngine::set_lod_freeze_distance);
+  ClassDB::bind_method(D_METHOD("get_lod_freeze_distance"), &SandEngine::get_lod_freeze_distance);
+  ClassDB::bind_method(D_METHOD("set_tick_budget_usec", "usec"), &SandEngine::set_tick_budget_usec);
+  ClassDB::bind_method(D_METHOD("get_tick_budget_usec"), &SandEngine::get_tick_budget_usec);
+  ClassDB::bind_method(D_METHOD("set_budget_max_catch_up", "ticks"), &SandEngine::set_budget_max_catch_up);
+  ClassDB::bind_method(D_METHOD("get_budget_max_catch_up"), &SandEngine::get_budget_max_catch_up);
+  ClassDB::bind_method(D_METHOD("get_budget_backlog"), &SandEngine::get_budget_backlog);
+  ClassDB::bind_method(D_METHOD("set_deterministic", "enabled"), &SandEngine::set_deterministic);
+  ClassDB::bind_method(D_METHOD("get_deterministic"), &SandEngine::get_deterministic);
+  ClassDB::bind_method(D_METHOD("set_deterministic_seed", "seed"), &SandEngine::set_deterministic_seed);
+  ClassDB::bind_method(D_METHOD("get_deterministic_seed"), &SandEngine::get_deterministic_seed);
+  ClassDB::bind_method(D_METHOD("get_state_hash"), &SandEngine::get_state_hash);
+  ClassDB::bind_method(D_METHOD("get_chunk_hashes"), &SandEngine::get_chunk_hashes);
+  ClassDB::bind_method(D_METHOD("find_desynced_chunks", "remote"), &SandEngine::find_desynced_chunks);
+  ClassDB::bind_method(D_METHOD("set_liquid_spans", "enabled"), &SandEngine::set_liquid_spans);
+  ClassDB::bind_method(D_METHOD("get_liquid_spans"), &SandEngine::get_liquid_spans);
+  ClassDB::bind_method(D_METHOD("get_grid_layout"), &SandEngine::get_grid_layout);
+  ClassDB::bind_method(D_METHOD("add_reaction", "reactant_a", "reactant_b", "product_a", "product_b", "probability", "byproduct"), &SandEngine::add_reaction, DEFVAL(1.0f), DEFVAL(0));
+  ClassDB::bind_method(D_METHOD("clear_reactions"), &SandEngine::clear_reactions);
+  ClassDB::bind_method(D_METHOD("get_reaction_frontier_size"), &SandEngine::get_reaction_frontier_size);
+  ClassDB::bind_method(D_METHOD("get_last_tick_reactions"), &SandEngine::get_last_tick_reactions);
+  ClassDB::bind_method(D_METHOD("get_frame"), &SandEngine::get_frame);
+  ClassDB::bind_method(D_METHOD("set_resting_velocity", "velocity"), &SandEngine::set_resting_velocity);
+  ClassDB::bind_method(D_METHOD("get_resting_velocity"), &SandEngine::get_resting_velocity);
+  ClassDB::bind_method(D_METHOD("set_flow_viscosity", "viscosity"), &SandEngine::set_flow_viscosity);
+  ClassDB::bind_method(D_METHOD("get_flow_viscosity"), &SandEngine::get_flow_viscosity);
+  ClassDB::bind_method(D_METHOD("set_external_stepping", "enabled"), &SandEngine::set_external_stepping);
+  ClassDB::bind_method(D_METHOD("get_external_stepping"), &SandEngine::get_external_stepping);
+  ClassDB::bind_static_method("SandEngine", D_METHOD("step_engines", "engines", "delta"), &SandEngine::step_engines);
   ClassDB::bind_method(D_METHOD("place_particle", "cell", "type"), &SandEngine::spawn_particle);
+  ClassDB::bind_method(D_METHOD("set_solid_mask", "mask"), &SandEngine::set_solid_mask);
+  ClassDB::bind_method(D_METHOD("get_solid_mask"), &SandEngine::get_solid_mask);
+  ClassDB::bind_method(D_METHOD("set_solid_outside_grid", "solid"), &SandEngine::set_solid_outside_grid);
+  ClassDB::bind_method(D_METHOD("get_solid_outside_grid"), &SandEngine::get_solid_outside_grid);
+  ClassDB::bind_method(D_METHOD("move_and_collide", "box", "motion"), &SandEngine::move_and_collide);
+  ClassDB::bind_method(D_METHOD("get_ground_height", "x_min", "x_max", "from_y", "max_depth"), &SandEngine::get_ground_height);
+  ClassDB::bind_method(D_METHOD("get_ground_normal", "x_min", "x_max", "from_y", "max_depth"), &SandEngine::get_ground_normal);
+  ClassDB::bind_method(D_METHOD("probe_step", "box", "direction", "max_step"), &SandEngine::probe_step);
+  ClassDB::bind_method(D_METHOD("set_debris_enabled", "enabled"), &SandEngine::set_debris_enabled);
+  ClassDB::bind_method(D_METHOD("get_debris_enabled"), &SandEngine::get_debris_enabled);
+  ClassDB::bind_method(D_METHOD("set_debris_anchor_mask", "mask"), &SandEngine::set_debris_anchor_mask);
+  ClassDB::bind_method(D_METHOD("get_debris_anchor_mask"), &SandEngine::get_debris_anchor_mask);
+  ClassDB::bind_method(D_METHOD("set_debris_min_cells", "cells"), &SandEngine::set_debris_min_cells);
+  ClassDB::bind_method(D_METHOD("get_debris_min_cells"), &SandEngine::get_debris_min_cells);
+  ClassDB::bind_method(D_METHOD("set_debris_max_cells", "cells"), &SandEngine::set_debris_max_cells);
+  ClassDB::bind_method(D_METHOD("get_debris_max_cells"), &SandEngine::get_debris_max_cells);
+  ClassDB::bind_method(D_METHOD("set_debris_settle_ticks", "ticks"), &SandEngine::set_debris_settle_ticks);
+  ClassDB::bind_method(D_METHOD("get_debris_settle_ticks"), &SandEngine::get_debris_settle_ticks);
+  ClassDB::bind_method(D_METHOD("get_debris_count"), &SandEngine::get_debris_count);
+  ClassDB::bind_method(D_METHOD("set_events_enabled", "enabled"), &SandEngine::set_events_enabled);
+  ClassDB::bind_method(D_METHOD("get_events_enabled"), &SandEngine::get_events_enabled);
+  ClassDB::bind_method(D_METHOD("set_events_capacity", "capacity"), &SandEngine::set_events_capacity);
+  ClassDB::bind_method(D_METHOD("get_events_capacity"), &SandEngine::get_events_capacity);
+  ClassDB::bind_method(D_METHOD("set_events_min_speed", "speed"), &SandEngine::set_events_min_speed);
+  ClassDB::bind_method(D_METHOD("get_events_min_speed"), &SandEngine::get_events_min_speed);
+  ClassDB::bind_method(D_METHOD("get_dropped_events"), &SandEngine::get_dropped_events);
   ClassDB::bind_method(D_METHOD("set_debug_mode", "mode"), &SandEngine::set_debug_mode);
   ClassDB::bind_method(D_METHOD("get_debug_mode"), &SandEngine::get_debug_mode);
   ClassDB::bind_method(D_METHOD("register_rigid_body"), &SandEngine::register_rigid_body);
+  ClassDB::bind_method(D_METHOD("capture_trace", "path", "frame_count", "first_frame"), &SandEngine::capture_trace, DEFVAL(-1));
+  ClassDB::bind_method(D_METHOD("is_capturing_trace"), &SandEngine::is_capturing_trace);
+
+  ADD_PROPERTY(PropertyInfo(Variant::INT, "grid_width", PROPERTY_HINT_RANGE, "1,16384,1"), "set_grid_width", "get_grid_width");
+  ADD_PROPERTY(PropertyInfo(Variant::INT, "grid_height", PROPERTY_HINT_RANGE, "1,16384,1"), "set_grid_height", "get_grid_height");
+  ADD_PROPERTY(PropertyInfo(Variant::INT, "max_particles", PROPERTY_HINT_RANGE, "0,10000000,1"), "set_max_particles", "get_max_particles");
+
+  ADD_PROPERTY(PropertyInfo(Variant::INT, "solid_mask"), "set_solid_mask", "get_solid_mask");
+  ADD_PROPERTY(PropertyInfo(Variant::BOOL, "solid_outside_grid"), "set_solid_outside_grid", "get_solid_outside_grid");
+  ADD_PROPERTY(PropertyInfo(Variant::BOOL, "liquid_spans"), "set_liquid_spans", "get_liquid_spans");
+  ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "resting_velocity", PROPERTY_HINT_RANGE, "0,2,0.01"), "set_resting_velocity", "get_resting_velocity");
+  ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "flow_viscosity", PROPERTY_HINT_RANGE, "0,100,0.1"), "set_flow_viscosity", "get_flow_viscosity");
+  ADD_PROPERTY(PropertyInfo(Variant::BOOL, "external_stepping"), "set_external_stepping", "get_external_stepping");
+  ADD_PROPERTY(PropertyInfo(Variant::BOOL, "deterministic"), "set_deterministic", "get_deterministic");
+  ADD_PROPERTY(PropertyInfo(Variant::INT, "deterministic_seed"), "set_deterministic_seed", "get_deterministic_seed");
+  ADD_PROPERTY(PropertyInfo(Variant::INT, "granular_mode", PROPERTY_HINT_ENUM, "Particles,Margolus"), "set_granular_mode", "get_granular_mode");
+
+  ADD_GROUP("Budget", "budget_");
+  ADD_PROPERTY(PropertyInfo(Variant::INT, "budget_tick_usec", PROPERTY_HINT_RANGE, "0,100000,100"), "set_tick_budget_usec", "get_tick_budget_usec");
+  ADD_PROPERTY(PropertyInfo(Variant::INT, "budget_max_catch_up", PROPERTY_HINT_RANGE, "1,64,1"), "set_budget_max_catch_up", "get_budget_max_catch_up");
+
+  ADD_GROUP("Debris", "debris_");
+  ADD_PROPERTY(PropertyInfo(Variant::BOOL, "debris_enabled"), "set_debris_enabled", "get_debris_enabled");
+  ADD_PROPERTY(PropertyInfo(Variant::INT, "debris_anchor_mask"), "set_debris_anchor_mask", "get_debris_anchor_mask");
+  ADD_PROPERTY(PropertyInfo(Variant::INT, "debris_min_cells", PROPERTY_HINT_RANGE, "1,65536,1"), "set_debris_min_cells", "get_debris_min_cells");
+  ADD_PROPERTY(PropertyInfo(Variant::INT, "debris_max_cells", PROPERTY_HINT_RANGE, "1,65536,1"), "set_debris_max_cells", "get_debris_max_cells");
+  ADD_PROPERTY(PropertyInfo(Variant::INT, "debris_settle_ticks", PROPERTY_HINT_RANGE, "0,600,1"), "set_debris_settle_ticks", "get_debris_settle_ticks");
+
+  ADD_GROUP("Events", "events_");
+  ADD_PROPERTY(PropertyInfo(Variant::BOOL, "events_enabled"), "set_events_enabled", "get_events_enabled");
+  ADD_PROPERTY(PropertyInfo(Variant::INT, "events_capacity", PROPERTY_HINT_RANGE, "1,1000000,1"), "set_events_capacity", "get_events_capacity");
+  ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "events_min_speed", PROPERTY_HINT_RANGE, "0,10,0.1"), "set_events_min_speed", "get_events_min_speed");
+
+  ADD_GROUP("Level Of Detail", "lod_");
+  ADD_PROPERTY(PropertyInfo(Variant::BOOL, "lod_enabled"), "set_lod_enabled", "get_lod_enabled");
+  ADD_PROPERTY(PropertyInfo(Variant::INT, "lod_margin", PROPERTY_HINT_RANGE, "0,4096,1"), "set_lod_margin", "get_lod_margin");
+  ADD_PROPERTY(PropertyInfo(Variant::INT, "lod_far_interval", PROPERTY_HINT_RANGE, "1,16,1"), "set_lod_far_interval", "get_lod_far_interval");
+  ADD_PROPERTY(PropertyInfo(Variant::INT, "lod_freeze_distance", PROPERTY_HINT_RANGE, "0,16384,1"), "set_lod_freeze_distance", "get_lod_freeze_distance");
+
+  // emitted when the grid is resized at runtime, the ssbo is recreated so renderers must rebind it
+  ADD_SIGNAL(MethodInfo("grid_resized"));
+  // once per tick for all sensors whose counts changed: counts holds MATERIAL_COUNT entries per id, indexed by material
+  ADD_SIGNAL(MethodInfo("sensors_changed", PropertyInfo(Variant::PACKED_INT32_ARRAY, "ids"), PropertyInfo(Variant::PACKED_INT32_ARRAY, "counts")));
+  // once per tick with events_enabled: one entry per chunk and event type, positions are centroids in cells
+  ADD_SIGNAL(MethodInfo("events_emitted", PropertyInfo(Variant::PACKED_INT32_ARRAY, "types"), PropertyInfo(Variant::PACKED_VECTOR2_ARRAY, "positions"), PropertyInfo(Variant::PACKED_INT32_ARRAY, "counts"), PropertyInfo(Variant::PACKED_FLOAT32_ARRAY, "speeds")));
 }
 
 void SandEngine::register_rigid_body(RigidBody2D *rBody)
@@ -42,6 +195,11 @@ SandEngine::SandEngine()
 {
   set_process(true);
   set_notify_transform(true);
+  events.reserve(4096);
+
+  // materials above foam are static terrain, sand piles can hold it up
+  structure.solidMask = ~((1u << 0) | (1u << Sand::TYPE) | (1u << Water::TYPE) | (1u << Water::FOAM_TYPE));
+  structure.supportMask = 1u << Sand::TYPE;
 }
 
 void SandEngine::_ready()
@@ -58,25 +216,16 @@ void SandEngine::_ready()
     return;
   }
 
-  cells.resize(width * height);
-  cellData.resize(width * height);
-  rigidyBodyOccupancy.resize(width * height);
-
-  // initialize cells
-  for (int i = 0; i < width * height; i++)
-  {
-    cells[i].type = 0;      // empty
-    cells[i].debug[0] = -1; // red
-    cells[i].debug[1] = -1; // green
-    cells[i].debug[2] = -1; // blue
-  }
+  allocate_grid();
+  reserve_particles(maxParticles);
+  initialized = true;
 
   // add 600 random sand particles
   for (int i = 0; i < 0; i++)
   {
     int x = rand() % width;
     int y = rand() % height;
-    if (cells[y * width + x].type != 0)
+    if (cells[gridIndex(x, y)].type != 0)
       continue; // skip occupied cells
 
     spawn_particle(Vector2i(x, y), 1); // type 1 = sand
@@ -97,311 +246,2023 @@ void SandEngine::_draw()
 
 SandEngine::~SandEngine()
 {
-  // destroy particles
-  for (auto p : particle_map)
+  // destroy particles, their storage is released with particleBlocks
+  for (Particle *p : particles)
   {
-    delete p.second;
+    if (p != nullptr)
+      p->~Particle();
   }
-  particle_map.clear();
+  particles.clear();
   active_particles.clear();
   // destroy cells
   cells.clear();
   cellData.clear();
 }
 
-void SandEngine::create_ssbo()
+void SandEngine::allocate_grid()
 {
-  size_t byte_size = cells.size() * sizeof(Cell);
-  PackedByteArray init;
-  init.resize(byte_size);
-  std::memset(init.ptrw(), 0, byte_size);
+  layout.configure(width, height);
+  cells.resize(layout.size);
+  cellData.resize(layout.size);
+  rigidyBodyOccupancy.resize(layout.size);
 
-  if (RenderingServer::get_singleton() == nullptr)
+  // initialize cells
+  for (size_t i = 0; i < layout.size; i++)
   {
-    UtilityFunctions::print("RenderingServer singleton is null!");
-    return;
+    cells[i].type = 0;      // empty
+    cells[i].debug[0] = -1; // red
+    cells[i].debug[1] = -1; // green
+    cells[i].debug[2] = -1; // blue
+    cellData[i].particle = nullptr;
+    rigidyBodyOccupancy[i] = 0;
   }
+  cellVisit.assign(layout.size, 0);
+  occupiedCells.clear();
+  lastOccupiedCells.clear();
+  reactions.resize(layout.size);
+  visitStamp = 0;
+
+  margolus.resize(width, height);
+  liquid.resize(width, height);
+
+  chunksX = (width + CHUNK_SIZE - 1) / CHUNK_SIZE;
+  chunksY = (height + CHUNK_SIZE - 1) / CHUNK_SIZE;
+  chunks.assign(chunksX * chunksY, Chunk());
+
+  sensors.reset(width, height, chunksX, chunksY, CHUNK_SIZE, [this](int x, int y)
+                { return type_at(x, y); });
+  forceFields.reset(chunksX, chunksY, CHUNK_SIZE);
+  // labels are built on the first update, so cells copied in by resize_grid are included
+  structure.reset(width, height, chunksX, chunksY, CHUNK_SIZE);
+  reset_state_hash();
+  events.reset(chunksX * chunksY);
+}
 
-  if (RenderingServer::get_singleton()->get_rendering_device() == nullptr)
+void SandEngine::update_chunk_lod()
+{
+  // the view differs between peers, a deterministic simulation updates everything every tick
+  bool useLod = lodEnabled && viewRect.has_area() && !deterministic;
+  Vector2i viewEnd = viewRect.get_end();
+
+  for (int cy = 0; cy < chunksY; cy++)
   {
-    UtilityFunctions::print("RenderingDevice is null!");
+    for (int cx = 0; cx < chunksX; cx++)
+    {
+      Chunk &c = chunks[cy * chunksX + cx];
+
+      if (!useLod)
+      {
+        c.lod = LOD_NEAR;
+      }
+      else
+      {
+        // distance in cells between the chunk and the view rect, 0 when overlapping
+        int x0 = cx * CHUNK_SIZE;
+        int y0 = cy * CHUNK_SIZE;
+        int gapX = MAX(MAX(viewRect.position.x - (x0 + CHUNK_SIZE), x0 - viewEnd.x), 0);
+        int gapY = MAX(MAX(viewRect.position.y - (y0 + CHUNK_SIZE), y0 - viewEnd.y), 0);
+        int gap = MAX(gapX, gapY);
+
+        if (gap <= lodMargin)
+          c.lod = LOD_NEAR;
+        else if (gap > lodFreezeDistance && !c.touched && c.quietUpdates >= lodSettleUpdates)
+          c.lod = LOD_FROZEN;
+        else
+          c.lod = LOD_FAR;
+      }
+
+      // far chunks are staggered so they do not all update on the same tick
+      c.updateThisTick = c.lod == LOD_NEAR || (c.lod == LOD_FAR && (frame + cx + cy) % lodFarInterval == 0);
+
+      if (c.updateThisTick)
+      {
+        c.quietUpdates = c.touched ? 0 : (uint16_t)MIN(c.quietUpdates + 1, 0xFFFF);
+        c.touched = false;
+      }
+    }
+  }
+}
+
+void SandEngine::reserve_particles(int capacity)
+{
+  if (capacity <= reservedParticles)
     return;
+
+  int blocks = (capacity + PARTICLE_BLOCK_SIZE - 1) / PARTICLE_BLOCK_SIZE;
+  while ((int)particleBlocks.size() < blocks)
+  {
+    particleBlocks.emplace_back(new uint8_t[PARTICLE_BLOCK_SIZE * PARTICLE_SLOT_SIZE]);
   }
 
-  RenderingDevice *rd = RenderingServer::get_singleton()->get_rendering_device();
-  ssbo_rid = rd->storage_buffer_create(init.size(), init);
+  particles.resize(capacity, nullptr);
+  activeIndex.resize(capacity, -1);
+  active_particles.reserve(capacity);
+  updateQueue.reserve(capacity);
+  freeIds.reserve(capacity);
+
+  // new slots go on top of the free list, lowest id first
+  for (int id = capacity - 1; id >= reservedParticles; id--)
+  {
+    freeIds.push_back(id);
+  }
+  reservedParticles = capacity;
 }
 
-void SandEngine::update_ssbo()
+void SandEngine::set_max_particles(int capacity)
 {
-  size_t byte_size = cells.size() * sizeof(Cell);
-  PackedByteArray data;
-  data.resize(byte_size);
-  std::memcpy(data.ptrw(), cells.data(), byte_size);
+  maxParticles = MAX(capacity, 0);
 
-  if (RenderingServer::get_singleton() == nullptr)
+  // lowering the capacity only lowers the spawn limit, reserved slots are kept
+  if (initialized)
+    reserve_particles(maxParticles);
+}
+
+void SandEngine::resize_grid(int new_width, int new_height)
+{
+  new_width = MAX(new_width, 1);
+  new_height = MAX(new_height, 1);
+  if (new_width == width && new_height == height)
+    return;
+
+  if (!initialized)
   {
-    UtilityFunctions::print("RenderingServer singleton is null!");
+    // storage is allocated in _ready
+    width = new_width;
+    height = new_height;
     return;
   }
 
-  if (RenderingServer::get_singleton()->get_rendering_device() == nullptr)
+  // particles that fall outside the new bounds are removed
+  for (Particle *p : particles)
   {
-    UtilityFunctions::print("RenderingDevice is null!");
-    return;
+    if (p != nullptr && (p->cell.x >= new_width || p->cell.y >= new_height))
+      delete_particle(p);
   }
 
-  RenderingDevice *rd = RenderingServer::get_singleton()->get_rendering_device();
-  rd->buffer_update(ssbo_rid, 0, data.size(), data);
+  std::vector<Cell> oldCells;
+  std::vector<CellInfo> oldCellData;
+  oldCells.swap(cells);
+  oldCellData.swap(cellData);
+  GridLayout oldLayout = layout;
+  int oldWidth = width;
+  int oldHeight = height;
+
+  width = new_width;
+  height = new_height;
+  allocate_grid();
+
+  // copy the overlapping region
+  for (int y = 0; y < MIN(oldHeight, height); y++)
+  {
+    for (int x = 0; x < MIN(oldWidth, width); x++)
+    {
+      cells[gridIndex(x, y)] = oldCells[oldLayout.index(x, y)];
+      cellData[gridIndex(x, y)] = oldCellData[oldLayout.index(x, y)];
+    }
+  }
+
+  // counts and contacts were taken on the empty grid in allocate_grid
+  rebuild_reaction_frontier();
+  sensors.reset(width, height, chunksX, chunksY, CHUNK_SIZE, [this](int x, int y)
+                { return type_at(x, y); });
+  reset_state_hash();
+
+  if (ssbo_rid.is_valid() && RenderingServer::get_singleton() != nullptr && RenderingServer::get_singleton()->get_rendering_device() != nullptr)
+  {
+    RenderingServer::get_singleton()->get_rendering_device()->free_rid(ssbo_rid);
+  }
+  create_ssbo();
+  update_ssbo();
+
+  queue_redraw();
+  emit_signal("grid_resized");
 }
 
-RID SandEngine::get_ssbo_rid() const
+void SandEngine::set_deterministic(bool enabled)
 {
-  return ssbo_rid;
+  bool enabling = enabled && !deterministic;
+  deterministic = enabled;
+  // hashes are not maintained outside deterministic mode
+  if (enabling && initialized)
+    reset_state_hash();
 }
 
-Vector2i SandEngine::find_last_available_cell(
-    const Vector2i &from,
-    const Vector2i &to) const
+void SandEngine::reset_state_hash()
 {
-  Vector2i last_available = from;
-  for_each_along_line(from, to, [&](const int &i, const Vector2i &cell)
-                      {
-                        if (i == 0)
-                          return false; // skip the starting cell
-                        if (i > 100)
-                        {
-                          print_line("Warning: find_last_available_cell exceeded 100 iterations, possible infinite loop. Returning last available cell found.");
-                          return true; // limit to 100 iterations to prevent infinite loops
-                        }
-                        if (cells[cell.y * width + cell.x].type != 0)
-                        {
-                          return true; // stop iterating
-                        }
-                        last_available = cell;
-                        return false; // continue iterating
-                      });
-
-  return last_available;
+  if (!deterministic)
+    return;
+  stateHash.reset(width, height, chunksX, chunksY, CHUNK_SIZE, [this](int x, int y)
+                  { return type_at(x, y); });
 }
 
-void SandEngine::for_each_along_line(
-    const Vector2i &from,
-    const Vector2i &to,
-    const std::function<bool(const int &, const Vector2i &)> &callback) const
+void SandEngine::seed_tick()
 {
-  int x0 = from.x;
-  int y0 = from.y;
-  int x1 = to.x;
-  int y1 = to.y;
+  // independent of what earlier ticks drew, so a peer joining from a snapshot stays in step
+  uint64_t seed = StateHash::mix((uint64_t)deterministicSeed ^ StateHash::mix((uint64_t)(uint32_t)frame));
+  rngState = (uint32_t)(seed >> 32) | 1u;
+}
 
-  int dx = abs(x1 - x0);
-  int sx = x0 < x1 ? 1 : -1;
+void SandEngine::shuffle_update_queue()
+{
+  // The active list's order depends on spawn and removal history (swap-remove, reused ids), so
+  // it is put in cell order first. One particle per cell makes the order canonical, and the
+  // Fisher-Yates after it only depends on the seed.
+  std::sort(updateQueue.begin(), updateQueue.end(), [this](uint32_t a, uint32_t b)
+            {
+              const Vector2i &ca = particles[a]->cell;
+              const Vector2i &cb = particles[b]->cell;
+              return ca.y != cb.y ? ca.y < cb.y : ca.x < cb.x; });
+  for (size_t i = updateQueue.size(); i > 1; i--)
+    std::swap(updateQueue[i - 1], updateQueue[next_random() % i]);
+}
 
-  int dy = -abs(y1 - y0);
-  int sy = y0 < y1 ? 1 : -1;
+PackedInt64Array SandEngine::get_chunk_hashes() const
+{
+  PackedInt64Array hashes;
+  const std::vector<uint64_t> &chunkHashes = stateHash.chunks();
+  hashes.resize((int64_t)chunkHashes.size());
+  for (size_t i = 0; i < chunkHashes.size(); i++)
+    hashes.set((int64_t)i, (int64_t)chunkHashes[i]);
+  return hashes;
+}
 
-  int err = dx + dy;
-  int i = 0;
+PackedVector2iArray SandEngine::find_desynced_chunks(const PackedInt64Array &remote) const
+{
+  PackedVector2iArray desynced;
+  const std::vector<uint64_t> &chunkHashes = stateHash.chunks();
+  ERR_FAIL_COND_V_MSG(remote.size() != (int64_t)chunkHashes.size(), desynced, "Chunk hash count does not match, is the grid the same size?");
 
-  while (true)
+  for (int i = 0; i < (int)chunkHashes.size(); i++)
   {
-    if (x0 < 0 || y0 < 0 || x0 >= width || y0 >= height)
-      break;
+    if ((int64_t)chunkHashes[i] != remote[i])
+      desynced.push_back(Vector2i(i % chunksX, i / chunksX));
+  }
+  return desynced;
+}
 
-    if (callback(i, Vector2i(x0, y0)))
-      break;
+uint32_t SandEngine::type_at(int x, int y) const
+{
+  if (x < 0 || y < 0 || x >= width || y >= height)
+    return 0;
+  return cells[gridIndex(x, y)].type;
+}
 
-    if (x0 == x1 && y0 == y1)
-      break;
+int SandEngine::add_sensor_rect(const Rect2i &rect)
+{
+  if (!initialized)
+    return -1;
 
-    i++;
-    int e2 = 2 * err;
-    if (e2 >= dy)
-    {
-      err += dy;
-      x0 += sx;
-    }
-    if (e2 <= dx)
+  // clipped by the sensor set, which keeps the full rect for when the grid grows
+  return sensors.add(rect, {}, [this](int x, int y)
+                     { return type_at(x, y); });
+}
+
+int SandEngine::add_sensor_polygon(const PackedVector2Array &polygon)
+{
+  if (!initialized || polygon.size() < 3)
+    return -1;
+
+  Vector2 lo = polygon[0];
+  Vector2 hi = polygon[0];
+  for (int i = 1; i < polygon.size(); i++)
+  {
+    lo.x = MIN(lo.x, polygon[i].x);
+    lo.y = MIN(lo.y, polygon[i].y);
+    hi.x = MAX(hi.x, polygon[i].x);
+    hi.y = MAX(hi.y, polygon[i].y);
+  }
+
+  Rect2i bounds = Rect2i((int)Math::floor(lo.x), (int)Math::floor(lo.y), (int)Math::ceil(hi.x - lo.x) + 1, (int)Math::ceil(hi.y - lo.y) + 1);
+
+  // rasterize once over the unclipped bounds, a cell belongs to the sensor when its center is
+  // inside the polygon
+  std::vector<uint8_t> mask(MAX(bounds.size.x * bounds.size.y, 0));
+  for (int y = 0; y < bounds.size.y; y++)
+  {
+    for (int x = 0; x < bounds.size.x; x++)
     {
-      err += dx;
-      y0 += sy;
+      Vector2 center(bounds.position.x + x + 0.5f, bounds.position.y + y + 0.5f);
+      mask[y * bounds.size.x + x] = Geometry2D::get_singleton()->is_point_in_polygon(center, polygon) ? 1 : 0;
     }
   }
+
+  return sensors.add(bounds, std::move(mask), [this](int x, int y)
+                     { return type_at(x, y); });
 }
 
-void SandEngine::spawn_particle(const Vector2i &cell, uint32_t type)
+void SandEngine::remove_sensor(int id)
 {
-  if (cell.x < 0 || cell.y < 0 || cell.x >= width || cell.y >= height)
-    return;
+  sensors.remove(id);
+}
 
-  if (cells[cell.y * width + cell.x].type != 0)
-    return;
+PackedInt32Array SandEngine::get_sensor_counts(int id) const
+{
+  PackedInt32Array counts;
+  if (!sensors.is_valid(id))
+    return counts;
+
+  counts.resize(MATERIAL_COUNT);
+  const int32_t *c = sensors.get_counts(id);
+  for (uint32_t m = 0; m < MATERIAL_COUNT; m++)
+    counts.set(m, c[m]);
+  return counts;
+}
 
-  if (rigidyBodyOccupancy[cell.y * width + cell.x] != 0)
-    return;
+int SandEngine::add_wind_zone(const Rect2i &box, const Vector2 &acceleration)
+{
+  int id = forceFields.add_wind(box, acceleration);
+  wake_force_field(id);
+  return id;
+}
 
-  if (type == Sand::TYPE)
-  {
-    Sand *p = new Sand{this, cell, Vector2(cell.x, cell.y), Vector2(0, 0)};
-    add_particle(cell.x, cell.y, p);
-  }
-  else if (type == Water::TYPE)
-  {
-    Water *p = new Water{this, cell, Vector2(cell.x, cell.y), Vector2(0, 0)};
-    add_particle(cell.x, cell.y, p);
-  }
+int SandEngine::add_vortex(const Vector2 &center, float radius, float strength)
+{
+  int id = forceFields.add_vortex(center, radius, strength);
+  wake_force_field(id);
+  return id;
 }
 
-void SandEngine::_physics_process(double delta)
+void SandEngine::remove_force_field(int id)
 {
-  if (Engine::get_singleton()->is_editor_hint())
+  if (!forceFields.is_valid(id))
     return;
-  frame++;
+  // what the field held in place settles again without it
+  wake_force_field(id);
+  forceFields.remove(id);
+}
 
-  // shuffle active particles
-  // std::vector<uint32_t> shuffled(active_particles.begin(), active_particles.end());
-  // std::shuffle(shuffled.begin(), shuffled.end(), std::default_random_engine(frame)); // shuffle
+int SandEngine::add_emitter(const Rect2i &area, int material, float rate, const Vector2 &velocity)
+{
+  if (material <= 0 || material >= (int)MATERIAL_COUNT || area.size.x <= 0 || area.size.y <= 0)
+    return -1;
+
+  EmitterSet::Emitter e;
+  e.area = EmitterSet::box(area);
+  e.material = (uint32_t)material;
+  e.rate = MAX(rate, 0.0f);
+  e.velocity = velocity;
+  return emitters.add_emitter(e);
+}
 
-  // clear rigidbodies
-  memset(rigidyBodyOccupancy.data(), 0, rigidyBodyOccupancy.size() * sizeof(int));
+int SandEngine::add_circle_emitter(const Vector2 &center, float radius, int material, float rate, const Vector2 &velocity)
+{
+  if (material <= 0 || material >= (int)MATERIAL_COUNT)
+    return -1;
+
+  EmitterSet::Emitter e;
+  e.area = EmitterSet::circle(center, radius);
+  e.material = (uint32_t)material;
+  e.rate = MAX(rate, 0.0f);
+  e.velocity = velocity;
+  return emitters.add_emitter(e);
+}
 
-  // clear debug
-  for (int i = 0; i < width * height; i++)
-  {
-    cells[i].debug[0] = -1;
-    cells[i].debug[1] = -1;
-    cells[i].debug[2] = -1;
-  }
+void SandEngine::set_emitter_enabled(int id, bool enabled)
+{
+  if (emitters.is_valid_emitter(id))
+    emitters.emitters[id].enabled = enabled;
+}
 
-  
-  std::vector<Particle*> affectedParticles;
+void SandEngine::set_emitter_rate(int id, float rate)
+{
+  if (emitters.is_valid_emitter(id))
+    emitters.emitters[id].rate = MAX(rate, 0.0f);
+}
 
-  // Scan rigidbodies and mark occupied cells, also mark debug
-  for (int i = 0; i < rigidBodies.size(); i++)
-  {
-    RigidBody2D *rb = rigidBodies[i];
-    CollisionShape2D *shape = static_cast<CollisionShape2D *>(rb->get_child(0));
-    Ref<Shape2D> shape2D = shape->get_shape();
+int SandEngine::add_drain(const Rect2i &area, int material_mask)
+{
+  if (area.size.x <= 0 || area.size.y <= 0)
+    return -1;
 
-    if (shape2D.is_null())
-      continue;
-    // shape 2d is a rectangle, get bounds
-    if (shape2D->get_class() == "RectangleShape2D")
-    {
-      Vector2 extents = static_cast<RectangleShape2D *>(shape2D.ptr())->get_size();
-      int width = static_cast<int>(extents.x/2);
-      int height = static_cast<int>(extents.y/2);
+  EmitterSet::Drain d;
+  d.area = EmitterSet::box(area);
+  d.materialMask = (uint32_t)material_mask & ~1u; // empty cells have nothing to remove
+  return emitters.add_drain(d);
+}
 
-      Transform2D global_transform = rb->get_global_transform();
-      for (int x = -width*2; x <= width*2; x++)
-      {
-        for (int y = -height*2; y <= height*2; y++)
-        {
-          // float locX = (float)x/(float)width;
-          // float locY = (float)y/(float)height;
+int SandEngine::add_circle_drain(const Vector2 &center, float radius, int material_mask)
+{
+  EmitterSet::Drain d;
+  d.area = EmitterSet::circle(center, radius);
+  d.materialMask = (uint32_t)material_mask & ~1u;
+  return emitters.add_drain(d);
+}
 
-          Vector2 point = global_transform.xform(Vector2((float)x/2.0f, (float)y/2.0f));
-          int grid_x = static_cast<int>(point.x);
-          int grid_y = static_cast<int>(point.y);
+void SandEngine::set_drain_enabled(int id, bool enabled)
+{
+  if (emitters.is_valid_drain(id))
+    emitters.drains[id].enabled = enabled;
+}
 
-          if (grid_x < 0 || grid_y < 0 || grid_x >= this->width || grid_y >= this->height)
-            continue;
+bool SandEngine::remove_particle(const Vector2i &cell)
+{
+  if (!initialized || get_cell(cell.x, cell.y) == nullptr)
+    return false;
+  if (get_particle(cell.x, cell.y) == nullptr && margolus.data()[cell.y * width + cell.x] != MargolusGrid::GRAIN)
+    return false; // static cells are not particles
+  erase_cell(cell.x, cell.y);
+  return true;
+}
 
-          rigidyBodyOccupancy[grid_y * this->width + grid_x] = i + 1;
+bool SandEngine::emit_cell(const int x, const int y, const EmitterSet::Emitter &emitter)
+{
+  if (emitter.material != Sand::TYPE && emitter.material != Water::TYPE)
+  {
+    set_static_cell(x, y, emitter.material);
+    return true;
+  }
+  if (granularMode == GRANULAR_MARGOLUS && emitter.material == Sand::TYPE)
+    return place_grain(Vector2i(x, y));
+
+  Particle *p = create_particle(Vector2i(x, y), emitter.material);
+  if (p == nullptr)
+    return false;
+  p->velocity = emitter.velocity;
+  return true;
+}
 
-          get_cell(grid_x, grid_y)->debug[0] = 255; // mark rigidbody occupied cells as red for debugging
-          get_cell(grid_x, grid_y)->debug[1] = 0;
-          get_cell(grid_x, grid_y)->debug[2] = 0;
+void SandEngine::run_emitters()
+{
+  for (EmitterSet::Emitter &e : emitters.emitters)
+  {
+    if (!e.alive || !e.enabled)
+      continue;
 
-          // check occupancy
-          if (get_cell(grid_x, grid_y)->type != 0)
-          {
-            // if occupied, move particle out of the way
-            Particle *p = get_particle(grid_x, grid_y);
-            if (p != nullptr)
-            {
-                affectedParticles.push_back(p);
-            }
-          }
+    e.pending += e.rate * (float)tickDelta;
+    int count = (int)e.pending;
+    e.pending -= (float)count;
 
-        }
+    const Rect2i &b = e.area.bounds;
+    for (int n = 0; n < count; n++)
+    {
+      // a few random probes per cell, a full emitter gives up instead of scanning its area
+      bool placed = false;
+      for (int attempt = 0; attempt < 4 && !placed; attempt++)
+      {
+        int x = b.position.x + (int)(next_random() % (uint32_t)b.size.x);
+        int y = b.position.y + (int)(next_random() % (uint32_t)b.size.y);
+        Cell *cell = get_cell(x, y);
+        if (cell == nullptr || cell->type != 0 || rigidyBodyOccupancy[gridIndex(x, y)] != 0 || !e.area.contains(x, y))
+          continue;
+        placed = emit_cell(x, y, e);
       }
+
+      if (placed)
+        e.spawned++;
+      else
+        e.blocked++;
     }
   }
+}
 
-
-  std::vector<uint32_t> to_update(
-      active_particles.begin(),
-      active_particles.end());
-
-  for (uint32_t pi : to_update)
+void SandEngine::run_drains()
+{
+  for (EmitterSet::Drain &d : emitters.drains)
   {
-    Particle *p = particle_map[pi];
-    p->update(delta);
+    if (!d.alive || !d.enabled)
+      continue;
+
+    const Rect2i &b = d.area.bounds;
+    int x0 = MAX(b.position.x, 0);
+    int y0 = MAX(b.position.y, 0);
+    int x1 = MIN(b.position.x + b.size.x, width);
+    int y1 = MIN(b.position.y + b.size.y, height);
+    for (int y = y0; y < y1; y++)
+    {
+      for (int x = x0; x < x1; x++)
+      {
+        uint32_t type = cells[gridIndex(x, y)].type;
+        if (type == 0 || type >= 32 || ((d.materialMask >> type) & 1u) == 0 || !d.area.contains(x, y))
+          continue;
+        if (remove_particle(Vector2i(x, y)))
+          d.removed++;
+      }
+    }
   }
+}
 
-  if (debugMode != ParticleDebugMode::NONE)
+void SandEngine::wake_force_field(int id)
+{
+  if (!initialized)
+    return;
+
+  // particles resting inside the field are woken once, the update applies it from then on
+  const Rect2i &b = forceFields.get_bounds(id);
+  int x0 = MAX(b.position.x, 0);
+  int y0 = MAX(b.position.y, 0);
+  int x1 = MIN(b.position.x + b.size.x, width);
+  int y1 = MIN(b.position.y + b.size.y, height);
+  for (int y = y0; y < y1; y++)
   {
-    for (auto &pi : particle_map)
+    for (int x = x0; x < x1; x++)
     {
-      Particle *p = pi.second;
-      p->update_debug();
+      Particle *p = cellData[gridIndex(x, y)].particle;
+      if (p == nullptr || p->active || !forceFields.contains(id, x, y))
+        continue;
+      p->set_active(true);
+      touch_chunks(x, y);
     }
   }
+}
 
+int SandEngine::apply_radial_impulse(const Vector2 &center, float radius, float strength, float carve_radius)
+{
+  if (!initialized || radius <= 0.0f)
+    return 0;
 
-  // // Move affected particles out of the way of rigidbodies
-  // for (Particle* p : affectedParticles) {
-  //   p->set_active(true);
-  //   int grid_x = p->cell.x;
-  //   int grid_y = p->cell.y;
-  //   Vector2i from = Vector2i(grid_x, grid_y);
-  //   Vector2i new_cell = from;
-
-  //   RigidBody2D* rb = get_rigid_body_at(grid_x, grid_y);
-  //   Vector2 body_center = rb->get_global_transform().get_origin();   
-  //   Vector2 force_dir = (body_center - Vector2(from.x, from.y)).normalized();
+  SAND_TRACE_ZONE(tracer, "radial_impulse");
 
-  //   Vector2i searchTo = from + Vector2i((int)(force_dir.x * 20), (int)(force_dir.y * 20)); // search up to 10 cells away in the direction away from the rigidbody
-  //   for_each_along_line(from, searchTo, [&](const int &i, const Vector2i &cell)
-  //   {
-  //       if (i == 0)
-  //           return false; // skip the starting cell
-  //       if (i > 100)
-  //       {
-  //           print_line("Warning: find_last_available_cell for rigidbody exceeded 100 iterations, possible infinite loop. Returning last available cell found.");
-  //           return true; // limit to 100 iterations to prevent infinite loops
-  //       }
+  int x0 = MAX((int)Math::floor(center.x - radius), 0);
+  int y0 = MAX((int)Math::floor(center.y - radius), 0);
+  int x1 = MIN((int)Math::ceil(center.x + radius), width - 1);
+  int y1 = MIN((int)Math::ceil(center.y + radius), height - 1);
+  if (x0 > x1 || y0 > y1)
+    return 0;
 
-  //       if (get_rigid_body_at(cell.x, cell.y) == nullptr)
-  //       {
-  //           new_cell = cell;
-  //           return true; // stop iterating once we find a non-rigidbody cell
-  //       }
-  //       return false; // continue iterating
-  //   });
+  float radius2 = radius * radius;
+  float carve2 = carve_radius * carve_radius;
+  int affected = 0;
 
-  //   p->externalVelocity.y = -0.5f; // give an initial upward velocity to help escape the rigidbody
-  //   // x away from center of rigidbody to help escape horizontally as well
+  for (int y = y0; y <= y1; y++)
+  {
+    for (int x = x0; x <= x1; x++)
+    {
+      float dx = x + 0.5f - center.x;
+      float dy = y + 0.5f - center.y;
+      float d2 = dx * dx + dy * dy;
+      if (d2 > radius2 || cells[gridIndex(x, y)].type == 0)
+        continue;
 
+      if (d2 <= carve2)
+      {
+        erase_cell(x, y);
+        affected++;
+        continue;
+      }
 
-  //   if (from.x < body_center.x)
-  //       p->externalVelocity.x = -0.5f;
-  //   else
-  //       p->externalVelocity.x = 0.5f;
+      // static cells and automaton grains do not carry a velocity
+      Particle *p = cellData[gridIndex(x, y)].particle;
+      if (p == nullptr)
+        continue;
 
+      float d = Math::sqrt(d2);
+      Vector2 dir = d > 0.001f ? Vector2(dx / d, dy / d) : Vector2(0, -1);
+      p->velocity += dir * (strength * (1.0f - d / radius));
+      p->set_active(true);
+      affected++;
+    }
+  }
 
-  //   // apply force to rbody from this position -> body center
-  //   Vector2 relPos = rb->get_global_transform().xform_inv(Vector2(from.x, from.y));
-  //   rb->apply_force(force_dir * 0.05f, relPos); // apply a strong force to try to move the rigidbody out of the way, otherwise the particle might get stuck
-  
-    
-  //   get_cell(grid_x, grid_y)->debug[0] = 0;
-  //   get_cell(grid_x, grid_y)->debug[1] = force_dir.y * 0.05f;
-  //   get_cell(grid_x, grid_y)->debug[2] = force_dir.x * 0.05f;
+  // wake every chunk the blast covered, frozen LOD chunks included
+  for (int cy = y0 / CHUNK_SIZE; cy <= y1 / CHUNK_SIZE; cy++)
+    for (int cx = x0 / CHUNK_SIZE; cx <= x1 / CHUNK_SIZE; cx++)
+      chunks[cy * chunksX + cx].touched = true;
 
-  // }
+  return affected;
+}
 
+int SandEngine::add_reaction(int reactant_a, int reactant_b, int product_a, int product_b, float probability, int byproduct)
+{
+  if (product_a < 0 || product_b < 0 || byproduct < 0 || product_a >= (int)MATERIAL_COUNT || product_b >= (int)MATERIAL_COUNT || byproduct >= (int)MATERIAL_COUNT)
+    return -1;
+  if (reactant_a <= 0 || reactant_b <= 0)
+    return -1; // empty cells do not react
+
+  ReactionSet::Rule rule{(uint32_t)reactant_a, (uint32_t)reactant_b, (uint32_t)product_a, (uint32_t)product_b, CLAMP(probability, 0.0f, 1.0f), (uint32_t)byproduct};
+  int id = reactions.add(rule);
+  if (id >= 0 && initialized)
+    rebuild_reaction_frontier(); // material that is already touching starts reacting
+  return id;
+}
+
+void SandEngine::clear_reactions()
+{
+  reactions.clear();
+}
+
+void SandEngine::rebuild_reaction_frontier()
+{
+  if (reactions.empty())
+    return;
+
+  for (int y = 0; y < height; y++)
+  {
+    for (int x = 0; x < width; x++)
+    {
+      uint32_t type = cells[gridIndex(x, y)].type;
+      if (type != 0)
+        mark_reactions(x, y, type);
+    }
+  }
+}
+
+void SandEngine::react()
+{
+  // cells a reaction replaced are stamped and skipped for the rest of the pass, the hook already
+  // marked their new contacts for the next tick, so nothing chains within one
+  visitStamp++;
+  reactions.take_frontier(reactingCells);
+  for (const Vector2i &c : reactingCells)
+    reactions.unmark(gridIndex(c.x, c.y));
+
+  static const Vector2i neighbors[4] = {Vector2i(1, 0), Vector2i(0, 1), Vector2i(-1, 0), Vector2i(0, -1)};
+  lastTickReactions = 0;
+  for (const Vector2i &c : reactingCells)
+  {
+    int index = gridIndex(c.x, c.y);
+    if (cellVisit[index] == visitStamp)
+      continue;
+    if (!chunks[chunkIndex(c.x, c.y)].updateThisTick)
+    {
+      reactions.mark(index, c); // frozen or skipped chunks keep their contacts for later
+      continue;
+    }
+
+    uint32_t type = cells[index].type;
+    uint32_t first = next_random();
+    bool touching = false;
+    bool reacted = false;
+    for (int k = 0; k < 4 && !reacted; k++)
+    {
+      Vector2i n = c + neighbors[(first + k) & 3];
+      Cell *other = get_cell(n.x, n.y);
+      if (other == nullptr || !reactions.reacts(type, other->type))
+        continue;
+      touching = true;
+      if (cellVisit[gridIndex(n.x, n.y)] == visitStamp)
+        continue;
+
+      bool swapped = false;
+      const ReactionSet::Rule *rule = reactions.find(type, other->type, swapped);
+      if (random_unit() >= rule->probability)
+        continue;
+
+      apply_reaction(c, n, *rule, swapped);
+      lastTickReactions++;
+      reacted = true;
+    }
+
+    // a contact that did not react this tick stays on the frontier, new contacts were marked by the hook
+    if (touching && !reacted)
+      reactions.mark(index, c);
+  }
+}
+
+void SandEngine::apply_reaction(const Vector2i &cell, const Vector2i &other, const ReactionSet::Rule &rule, bool swapped)
+{
+  replace_cell(cell.x, cell.y, swapped ? rule.productB : rule.productA);
+  replace_cell(other.x, other.y, swapped ? rule.productA : rule.productB);
+  cellVisit[gridIndex(cell.x, cell.y)] = visitStamp;
+  cellVisit[gridIndex(other.x, other.y)] = visitStamp;
+
+  if (rule.byproduct == 0)
+    return;
+
+  static const Vector2i around[4] = {Vector2i(0, -1), Vector2i(-1, 0), Vector2i(1, 0), Vector2i(0, 1)};
+  for (const Vector2i &origin : {cell, other})
+  {
+    for (const Vector2i &d : around)
+    {
+      Vector2i n = origin + d;
+      Cell *c = get_cell(n.x, n.y);
+      if (c != nullptr && c->type == 0 && rigidyBodyOccupancy[gridIndex(n.x, n.y)] == 0)
+      {
+        replace_cell(n.x, n.y, rule.byproduct);
+        cellVisit[gridIndex(n.x, n.y)] = visitStamp;
+        return;
+      }
+    }
+  }
+}
+
+void SandEngine::replace_cell(const int x, const int y, uint32_t type)
+{
+  Cell *cell = get_cell(x, y);
+  if (cell == nullptr || cell->type == type)
+    return;
+
+  erase_cell(x, y);
+  if (type == 0)
+    return;
+
+  // materials with a particle class move, anything else becomes a static cell
+  if (type == Sand::TYPE || type == Water::TYPE)
+    spawn_particle(Vector2i(x, y), type);
+  else
+    set_static_cell(x, y, type);
+}
+
+void SandEngine::emit_events()
+{
+  events.take_groups(eventGroups);
+  if (eventGroups.empty())
+    return;
+
+  PackedInt32Array types;
+  PackedVector2Array positions;
+  PackedInt32Array counts;
+  PackedFloat32Array speeds;
+  types.resize(eventGroups.size());
+  positions.resize(eventGroups.size());
+  counts.resize(eventGroups.size());
+  speeds.resize(eventGroups.size());
+  int32_t *typesOut = types.ptrw();
+  Vector2 *positionsOut = positions.ptrw();
+  int32_t *countsOut = counts.ptrw();
+  float *speedsOut = speeds.ptrw();
+  for (size_t i = 0; i < eventGroups.size(); i++)
+  {
+    const EventLog::Group &g = eventGroups[i];
+    typesOut[i] = g.type;
+    positionsOut[i] = Vector2(g.x, g.y);
+    countsOut[i] = g.count;
+    speedsOut[i] = g.speed;
+  }
+
+  emit_signal("events_emitted", types, positions, counts, speeds);
+}
+
+void SandEngine::emit_sensor_changes()
+{
+  if (!sensors.has_changes())
+    return;
+
+  sensors.take_changes(changedSensors);
+
+  PackedInt32Array ids;
+  PackedInt32Array counts;
+  ids.resize(changedSensors.size());
+  counts.resize(changedSensors.size() * MATERIAL_COUNT);
+  int32_t *idsOut = ids.ptrw();
+  int32_t *countsOut = counts.ptrw();
+  for (size_t i = 0; i < changedSensors.size(); i++)
+  {
+    idsOut[i] = changedSensors[i];
+    std::memcpy(countsOut + i * MATERIAL_COUNT, sensors.get_counts(changedSensors[i]), MATERIAL_COUNT * sizeof(int32_t));
+  }
+
+  emit_signal("sensors_changed", ids, counts);
+}
+
+void SandEngine::create_ssbo()
+{
+  size_t byte_size = cells.size() * sizeof(Cell);
+  PackedByteArray init;
+  init.resize(byte_size);
+  std::memset(init.ptrw(), 0, byte_size);
+
+  if (RenderingServer::get_singleton() == nullptr)
+  {
+    UtilityFunctions::print("RenderingServer singleton is null!");
+    return;
+  }
+
+  if (RenderingServer::get_singleton()->get_rendering_device() == nullptr)
+  {
+    UtilityFunctions::print("RenderingDevice is null!");
+    return;
+  }
+
+  RenderingDevice *rd = RenderingServer::get_singleton()->get_rendering_device();
+  ssbo_rid = rd->storage_buffer_create(init.size(), init);
+}
+
+void SandEngine::update_ssbo()
+{
+  SAND_TRACE_ZONE(tracer, "update_ssbo");
+  size_t byte_size = cells.size() * sizeof(Cell);
+  PackedByteArray data;
+  data.resize(byte_size);
+  std::memcpy(data.ptrw(), cells.data(), byte_size);
+
+  if (RenderingServer::get_singleton() == nullptr)
+  {
+    UtilityFunctions::print("RenderingServer singleton is null!");
+    return;
+  }
+
+  if (RenderingServer::get_singleton()->get_rendering_device() == nullptr)
+  {
+    UtilityFunctions::print("RenderingDevice is null!");
+    return;
+  }
+
+  RenderingDevice *rd = RenderingServer::get_singleton()->get_rendering_device();
+  rd->buffer_update(ssbo_rid, 0, data.size(), data);
+}
+
+RID SandEngine::get_ssbo_rid() const
+{
+  return ssbo_rid;
+}
+
+void SandEngine::capture_trace(const String &path, int frame_count, int first_frame)
+{
+#ifndef SAND_TRACE_ENABLED
+  ERR_FAIL_MSG("capture_trace: tracing is not compiled in, rebuild with `scons trace=yes`");
+#else
+  // the next tick is the earliest one that can still be recorded
+  if (first_frame <= frame)
+  {
+    if (first_frame >= 0)
+      UtilityFunctions::print("capture_trace: frame ", first_frame, " has already run, starting at ", frame + 1);
+    first_frame = frame + 1;
+  }
+  tracer.capture(path, first_frame, frame_count, get_instance_id());
+#endif
+}
+
+Vector2i SandEngine::find_last_available_cell(
+    const Vector2i &from,
+    const Vector2i &to) const
+{
+  Vector2i last_available = from;
+  for_each_along_line(from, to, [&](const int &i, const Vector2i &cell)
+                      {
+                        if (i == 0)
+                          return false; // skip the starting cell
+                        if (i > 100)
+                        {
+                          print_line("Warning: find_last_available_cell exceeded 100 iterations, possible infinite loop. Returning last available cell found.");
+                          return true; // limit to 100 iterations to prevent infinite loops
+                        }
+                        if (cells[gridIndex(cell.x, cell.y)].type != 0)
+                        {
+                          return true; // stop iterating
+                        }
+                        last_available = cell;
+                        return false; // continue iterating
+                      });
+
+  return last_available;
+}
+
+void SandEngine::for_each_along_line(
+    const Vector2i &from,
+    const Vector2i &to,
+    const std::function<bool(const int &, const Vector2i &)> &callback) const
+{
+  int x0 = from.x;
+  int y0 = from.y;
+  int x1 = to.x;
+  int y1 = to.y;
+
+  int dx = abs(x1 - x0);
+  int sx = x0 < x1 ? 1 : -1;
+
+  int dy = -abs(y1 - y0);
+  int sy = y0 < y1 ? 1 : -1;
+
+  int err = dx + dy;
+  int i = 0;
+
+  while (true)
+  {
+    if (x0 < 0 || y0 < 0 || x0 >= width || y0 >= height)
+      break;
+
+    if (callback(i, Vector2i(x0, y0)))
+      break;
+
+    if (x0 == x1 && y0 == y1)
+      break;
+
+    i++;
+    int e2 = 2 * err;
+    if (e2 >= dy)
+    {
+      err += dy;
+      x0 += sx;
+    }
+    if (e2 <= dx)
+    {
+      err += dx;
+      y0 += sy;
+    }
+  }
+}
+
+bool SandEngine::is_region_solid(int x0, int y0, int x1, int y1) const
+{
+  for (int y = y0; y <= y1; y++)
+  {
+    for (int x = x0; x <= x1; x++)
+    {
+      if (is_solid(x, y))
+        return true;
+    }
+  }
+  return false;
+}
+
+// cells covered by a box, the far edges are exclusive
+static void box_cells(const Rect2 &box, int &x0, int &y0, int &x1, int &y1)
+{
+  x0 = (int)Math::floor(box.position.x);
+  y0 = (int)Math::floor(box.position.y);
+  x1 = (int)Math::ceil(box.position.x + box.size.x) - 1;
+  y1 = (int)Math::ceil(box.position.y + box.size.y) - 1;
+}
+
+float SandEngine::sweep_box_axis(Rect2 &box, float motion, int axis, Vector2 &normal) const
+{
+  if (motion == 0.0f)
+    return 0.0f;
+
+  int x0, y0, x1, y1;
+  box_cells(box, x0, y0, x1, y1);
+
+  float start = axis == 0 ? box.position.x : box.position.y;
+  float extent = axis == 0 ? box.size.x : box.size.y;
+  int dir = motion > 0 ? 1 : -1;
+
+  // walk the rows (or columns) of cells the leading edge enters, the first solid one stops the box
+  int first = dir > 0 ? (int)Math::ceil(start + extent) : (int)Math::floor(start) - 1;
+  int last = dir > 0 ? (int)Math::ceil(start + extent + motion) - 1 : (int)Math::floor(start + motion);
+  float moved = motion;
+  for (int line = first; dir > 0 ? line <= last : line >= last; line += dir)
+  {
+    bool blocked = axis == 0 ? is_region_solid(line, y0, line, y1) : is_region_solid(x0, line, x1, line);
+    if (blocked)
+    {
+      moved = dir > 0 ? line - (start + extent) : (line + 1) - start;
+      if (axis == 0)
+        normal = Vector2(-dir, 0);
+      else
+        normal = Vector2(0, -dir);
+      break;
+    }
+  }
+
+  if (axis == 0)
+    box.position.x += moved;
+  else
+    box.position.y += moved;
+  return moved;
+}
+
+Vector2 SandEngine::resolve_box_penetration(Rect2 &box) const
+{
+  int x0, y0, x1, y1;
+  box_cells(box, x0, y0, x1, y1);
+  if (!is_region_solid(x0, y0, x1, y1))
+    return Vector2();
+
+  // shortest whole cell push that frees the box, up first since buried characters climb out
+  const Vector2i directions[4] = {Vector2i(0, -1), Vector2i(1, 0), Vector2i(-1, 0), Vector2i(0, 1)};
+  int limit = (int)Math::ceil(MAX(box.size.x, box.size.y)) + 1;
+  for (int depth = 1; depth <= limit; depth++)
+  {
+    for (const Vector2i &d : directions)
+    {
+      if (!is_region_solid(x0 + d.x * depth, y0 + d.y * depth, x1 + d.x * depth, y1 + d.y * depth))
+      {
+        Vector2 push = Vector2(d.x, d.y) * (float)depth;
+        box.position += push;
+        return push;
+      }
+    }
+  }
+  return Vector2(); // fully enclosed, leave it to the caller
+}
+
+Dictionary SandEngine::move_and_collide(const Rect2 &box, const Vector2 &motion) const
+{
+  Rect2 moved = box;
+  Vector2 normal;
+  Vector2 push = resolve_box_penetration(moved);
+  if (push != Vector2())
+    normal = push.normalized();
+
+  // axis separated so the box slides along walls and floors
+  Vector2 travel;
+  travel.x = sweep_box_axis(moved, motion.x, 0, normal);
+  travel.y = sweep_box_axis(moved, motion.y, 1, normal);
+
+  Dictionary result;
+  result["position"] = moved.position;
+  result["travel"] = travel;
+  result["remainder"] = motion - travel;
+  result["collided"] = travel != motion || push != Vector2();
+  result["normal"] = normal;
+  result["penetration"] = push.length();
+  return result;
+}
+
+int SandEngine::get_ground_height(int x_min, int x_max, int from_y, int max_depth) const
+{
+  int ground = -1;
+  for (int x = x_min; x <= x_max; x++)
+  {
+    int column = column_ground(x, from_y, max_depth);
+    if (column >= 0 && (ground < 0 || column < ground))
+      ground = column;
+  }
+  return ground;
+}
+
+Vector2 SandEngine::get_ground_normal(int x_min, int x_max, int from_y, int max_depth) const
+{
+  // least squares slope of the column heights
+  float n = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+  for (int x = x_min; x <= x_max; x++)
+  {
+    int y = column_ground(x, from_y, max_depth);
+    if (y < 0)
+      continue;
+    n++;
+    sx += x;
+    sy += y;
+    sxx += (float)x * x;
+    sxy += (float)x * y;
+  }
+
+  float denominator = n * sxx - sx * sx;
+  if (n < 2 || denominator == 0.0f)
+    return Vector2(0, -1);
+  float slope = (n * sxy - sx * sy) / denominator;
+  return Vector2(slope, -1).normalized();
+}
+
+int SandEngine::probe_step(const Rect2 &box, int direction, int max_step) const
+{
+  int x0, y0, x1, y1;
+  box_cells(box, x0, y0, x1, y1);
+  int dx = direction < 0 ? -1 : 1;
+
+  for (int step = 0; step <= max_step; step++)
+  {
+    // needs headroom above the box as well as space one cell ahead at that height
+    if (step > 0 && is_region_solid(x0, y0 - step, x1, y0 - step))
+      return -1;
+    if (!is_region_solid(x0 + dx, y0 - step, x1 + dx, y1 - step))
+      return step;
+  }
+  return -1;
+}
+
+int SandEngine::column_ground(int x, int from_y, int max_depth) const
+{
+  if (x < 0 || x >= width)
+    return -1;
+  for (int y = MAX(from_y, 0); y <= from_y + max_depth && y < height; y++)
+  {
+    if (is_solid(x, y))
+      return y;
+  }
+  return -1;
+}
+
+void SandEngine::shift_column(const int x, const int top, const int bottom, const int shift)
+{
+  // bottom first, every target row is either empty or was just moved out of
+  for (int y = bottom; y >= top; y--)
+  {
+    Particle *p = cellData[gridIndex(x, y)].particle;
+    p->cell.y = y + shift;
+    p->position.y = (float)(y + shift);
+    p->lastMoveFrame = frame;
+    cellData[gridIndex(x, y + shift)].particle = p;
+  }
+
+  // rows that only the old run covered empty out, rows that only the new one covers fill up
+  for (int y = top; y <= MIN(bottom, top + shift - 1); y++)
+  {
+    touch_chunks(x, y);
+    cell_type_changed(x, y, Sand::TYPE, 0);
+    cells[gridIndex(x, y)].type = 0;
+    cellData[gridIndex(x, y)].particle = nullptr;
+  }
+  for (int y = MAX(top + shift, bottom + 1); y <= bottom + shift; y++)
+  {
+    touch_chunks(x, y);
+    cell_type_changed(x, y, 0, Sand::TYPE);
+    cells[gridIndex(x, y)].type = Sand::TYPE;
+  }
+
+  // grains beside the gap left on top can slide in, the run lands next to the ones at the bottom
+  for (int y = top - 1; y <= MIN(bottom, top + shift - 1); y += 2)
+    wake_neighbors(x, y + 1);
+  wake_neighbors(x, bottom + shift);
+}
+
+void SandEngine::spawn_particle(const Vector2i &cell, uint32_t type)
+{
+  if (granularMode == GRANULAR_MARGOLUS && type == Sand::TYPE)
+  {
+    place_grain(cell);
+    return;
+  }
+  create_particle(cell, type);
+}
+
+bool SandEngine::place_grain(const Vector2i &cell)
+{
+  if (!initialized)
+    return false;
+
+  if (cell.x < 0 || cell.y < 0 || cell.x >= width || cell.y >= height)
+    return false;
+
+  int i = gridIndex(cell.x, cell.y);
+  if (cells[i].type != 0 || rigidyBodyOccupancy[i] != 0)
+    return false;
+
+  // grains have no particle, they render and block as sand
+  margolus.data()[cell.y * width + cell.x] = MargolusGrid::GRAIN;
+  set_static_cell(cell.x, cell.y, Sand::TYPE);
+  hasGrains = true;
+  log_event(EVENT_SPAWN, cell, 0.0f);
+  return true;
+}
+
+struct MargolusBands
+{
+  MargolusGrid *grid;
+  Tracer *tracer;
+  uint32_t step;
+  int rows;
+  int rowsPerBand;
+};
+
+static const int MARGOLUS_BAND_ROWS = 16; // block rows per worker task
+
+void SandEngine::solve_liquids()
+{
+  liquidSeeds.clear();
+  for (uint32_t id : active_particles)
+  {
+    Particle *p = particles[id];
+    if (p->type == Water::TYPE && chunks[chunkIndex(p->cell.x, p->cell.y)].updateThisTick)
+      liquidSeeds.push_back(p);
+  }
+  if (!liquidSeeds.empty())
+    liquid.solve(this, liquidSeeds, Water::TYPE);
+}
+
+void SandEngine::step_margolus_band(void *userdata, uint32_t band)
+{
+  MargolusBands *bands = static_cast<MargolusBands *>(userdata);
+  SAND_TRACE_ZONE_ARG(*bands->tracer, "margolus_band", "worker", band);
+  int first = band * bands->rowsPerBand;
+  bands->grid->step_block_rows(first, MIN(first + bands->rowsPerBand, bands->rows), bands->step);
+}
+
+void SandEngine::step_margolus()
+{
+  if (!hasGrains)
+    return;
+
+  SAND_TRACE_ZONE(tracer, "margolus_step");
+  uint8_t *states = margolus.data();
+
+  // everything the automaton does not own is a wall this tick
+  for (int y = 0; y < height; y++)
+  {
+    for (int x = 0; x < width; x++)
+    {
+      uint8_t &s = states[y * width + x];
+      if (s != MargolusGrid::GRAIN)
+      {
+        int i = gridIndex(x, y);
+        s = (cells[i].type != 0 || rigidyBodyOccupancy[i] != 0) ? MargolusGrid::WALL : MargolusGrid::EMPTY;
+      }
+    }
+  }
+  margolus.snapshot();
+
+  // blocks never overlap within a step, so bands of block rows run in parallel
+  MargolusBands bands{&margolus, &tracer, margolusStep, margolus.block_rows(margolusStep), MARGOLUS_BAND_ROWS};
+  int bandCount = (bands.rows + MARGOLUS_BAND_ROWS - 1) / MARGOLUS_BAND_ROWS;
+  WorkerThreadPool *pool = WorkerThreadPool::get_singleton();
+  if (pool != nullptr && bandCount > 1 && !onWorkerThread)
+  {
+    int64_t task = pool->add_native_group_task(&SandEngine::step_margolus_band, &bands, bandCount, -1, true, "SandEngine margolus step");
+    pool->wait_for_group_task_completion(task);
+  }
+  else
+  {
+    for (int band = 0; band < bandCount; band++)
+      step_margolus_band(&bands, band);
+  }
+  margolusStep++;
+
+  // mirror moved grains into the cell grid
+  const uint8_t *before = margolus.previous_data();
+  for (int y = 0; y < height; y++)
+  {
+    for (int x = 0; x < width; x++)
+    {
+      int i = y * width + x;
+      bool isGrain = states[i] == MargolusGrid::GRAIN;
+      if (isGrain == (before[i] == MargolusGrid::GRAIN))
+        continue;
+
+      if (isGrain)
+        set_static_cell(x, y, Sand::TYPE);
+      else
+        clear_cell(x, y);
+    }
+  }
+}
+
+Particle *SandEngine::construct_particle(uint32_t id, const Vector2i &cell, uint32_t type)
+{
+  uint8_t *slot = particleBlocks[id / PARTICLE_BLOCK_SIZE].get() + (id % PARTICLE_BLOCK_SIZE) * PARTICLE_SLOT_SIZE;
+
+  Particle *p = nullptr;
+  if (type == Sand::TYPE)
+    p = new (slot) Sand{this, cell, Vector2(cell.x, cell.y), Vector2(0, 0)};
+  else if (type == Water::TYPE)
+    p = new (slot) Water{this, cell, Vector2(cell.x, cell.y), Vector2(0, 0)};
+
+  if (p != nullptr)
+    p->id = id;
+  return p;
+}
+
+Particle *SandEngine::create_particle(const Vector2i &cell, uint32_t type)
+{
+  if (!initialized)
+    return nullptr;
+
+  if (cell.x < 0 || cell.y < 0 || cell.x >= width || cell.y >= height)
+    return nullptr;
+
+  if (cells[gridIndex(cell.x, cell.y)].type != 0)
+    return nullptr;
+
+  if (rigidyBodyOccupancy[gridIndex(cell.x, cell.y)] != 0)
+    return nullptr;
+
+  if (particleCount >= maxParticles || freeIds.empty())
+  {
+    refusedSpawns++;
+    return nullptr;
+  }
+
+  Particle *p = construct_particle(freeIds.back(), cell, type);
+  if (p == nullptr)
+    return nullptr; // unknown type
+
+  freeIds.pop_back();
+  p->lastUpdateFrame = frame;
+  add_particle(cell.x, cell.y, p);
+  log_event(EVENT_SPAWN, cell, 0.0f);
+  return p;
+}
+
+void SandEngine::rasterize_rigid_bodies()
+{
+  displacedCells.clear();
+  visitStamp++;
+
+  // the displacement pass may run on a worker thread, so it only gets to see this copy
+  bodyStates.resize(rigidBodies.size());
+  for (int i = 0; i < rigidBodies.size(); i++)
+  {
+    RigidBody2D *rb = rigidBodies[i];
+    bodyStates[i].transform = rb->get_global_transform();
+    bodyStates[i].velocity = rb->get_linear_velocity();
+
+    DebrisPiece *piece = find_debris(rb);
+    if (piece != nullptr)
+    {
+      rasterize_debris(i, *piece);
+      continue;
+    }
+
+    CollisionShape2D *shape = rb->get_child_count() > 0 ? Object::cast_to<CollisionShape2D>(rb->get_child(0)) : nullptr;
+    if (shape == nullptr)
+      continue;
+    Ref<Shape2D> shape2D = shape->get_shape();
+
+    if (shape2D.is_null())
+      continue;
+    // shape 2d is a rectangle, get bounds
+    if (shape2D->get_class() == "RectangleShape2D")
+    {
+      Vector2 extents = static_cast<RectangleShape2D *>(shape2D.ptr())->get_size();
+      int width = static_cast<int>(extents.x/2);
+      int height = static_cast<int>(extents.y/2);
+
+      Transform2D global_transform = rb->get_global_transform();
+      for (int x = -width*2; x <= width*2; x++)
+      {
+        for (int y = -height*2; y <= height*2; y++)
+        {
+          Vector2 point = global_transform.xform(Vector2((float)x/2.0f, (float)y/2.0f));
+          occupy_cell(static_cast<int>(point.x), static_cast<int>(point.y), i);
+        }
+      }
+    }
+  }
+}
+
+void SandEngine::occupy_cell(int grid_x, int grid_y, int body)
+{
+  if (grid_x < 0 || grid_y < 0 || grid_x >= this->width || grid_y >= this->height)
+    return;
+
+  int index = gridIndex(grid_x, grid_y);
+  if (rigidyBodyOccupancy[index] == 0)
+    occupiedCells.push_back(Vector2i(grid_x, grid_y));
+  rigidyBodyOccupancy[index] = body + 1;
+
+  get_cell(grid_x, grid_y)->debug[0] = 255; // mark rigidbody occupied cells as red for debugging
+  get_cell(grid_x, grid_y)->debug[1] = 0;
+  get_cell(grid_x, grid_y)->debug[2] = 0;
+
+  // the half cell sampling hits most cells several times, only queue each once
+  if (get_cell(grid_x, grid_y)->type != 0 && cellVisit[index] != visitStamp)
+  {
+    cellVisit[index] = visitStamp;
+    touch_chunks(grid_x, grid_y); // wakes frozen chunks the body is pushing into
+
+    // particles and automaton grains get pushed out, static cells stay put
+    if (get_particle(grid_x, grid_y) != nullptr || margolus.data()[grid_y * this->width + grid_x] == MargolusGrid::GRAIN)
+      displacedCells.push_back({Vector2i(grid_x, grid_y), body});
+  }
+}
+
+void SandEngine::displace_overlapped_cells()
+{
+  if (displacedCells.empty())
+    return;
+
+  // One breadth-first search from every overlapped cell at once. It walks through bodies and
+  // movable material (not static cells) and collects the nearest free cells for each body.
+  visitStamp++;
+  int bodyCount = (int)bodyStates.size();
+  displacementNeeded.assign(bodyCount, 0);
+  displacementFound.assign(bodyCount, 0);
+  freeCells.clear();
+  bfsQueue.clear();
+
+  for (const DisplacedCell &d : displacedCells)
+  {
+    displacementNeeded[d.body]++;
+    cellVisit[gridIndex(d.cell.x, d.cell.y)] = visitStamp;
+    bfsQueue.push_back(d);
+  }
+
+  // neighbours are tried along the body's motion first, so material is pushed ahead of it
+  std::vector<Vector2i> &order = neighborOrder;
+  order.resize(bodyCount * 4);
+  for (int b = 0; b < bodyCount; b++)
+  {
+    Vector2 v = bodyStates[b].velocity;
+    Vector2i major = Math::abs(v.x) > Math::abs(v.y) ? Vector2i(v.x > 0 ? 1 : -1, 0) : Vector2i(0, v.y > 0 ? 1 : -1);
+    if (v.length_squared() < 1.0f)
+      major = Vector2i(0, -1); // resting bodies push material up
+    Vector2i side(major.y, major.x);
+    order[b * 4 + 0] = major;
+    order[b * 4 + 1] = side;
+    order[b * 4 + 2] = Vector2i(-side.x, -side.y);
+    order[b * 4 + 3] = Vector2i(-major.x, -major.y);
+  }
+
+  int remaining = (int)displacedCells.size();
+  size_t budget = displacedCells.size() * 64 + 4096;
+  for (size_t head = 0; head < bfsQueue.size() && remaining > 0 && bfsQueue.size() < budget; head++)
+  {
+    DisplacedCell current = bfsQueue[head];
+    for (int n = 0; n < 4; n++)
+    {
+      Vector2i next = current.cell + order[current.body * 4 + n];
+      if (next.x < 0 || next.y < 0 || next.x >= width || next.y >= height)
+        continue;
+
+      int index = gridIndex(next.x, next.y);
+      if (cellVisit[index] == visitStamp)
+        continue;
+      cellVisit[index] = visitStamp;
+
+      bool occupiedByBody = rigidyBodyOccupancy[index] != 0;
+      if (cells[index].type == 0 && !occupiedByBody)
+      {
+        if (displacementFound[current.body] < displacementNeeded[current.body])
+        {
+          displacementFound[current.body]++;
+          remaining--;
+          freeCells.push_back({next, current.body});
+        }
+        continue;
+      }
+
+      bool movable = cellData[index].particle != nullptr || margolus.data()[next.y * width + next.x] == MargolusGrid::GRAIN;
+      if (occupiedByBody || movable)
+        bfsQueue.push_back({next, current.body});
+    }
+  }
+
+  // pair overlapped and free cells of the same body in order along the body's surface,
+  // so material from its left side ends up on the left side
+  auto by_surface = [&](const DisplacedCell &a, const DisplacedCell &b)
+  {
+    if (a.body != b.body)
+      return a.body < b.body;
+    Vector2i side = order[a.body * 4 + 1];
+    int da = a.cell.x * side.x + a.cell.y * side.y;
+    int db = b.cell.x * side.x + b.cell.y * side.y;
+    if (da != db)
+      return da < db;
+    // cells at the same depth are ordered by position so the pairing is deterministic
+    return a.cell.y != b.cell.y ? a.cell.y < b.cell.y : a.cell.x < b.cell.x;
+  };
+  std::sort(displacedCells.begin(), displacedCells.end(), by_surface);
+  std::sort(freeCells.begin(), freeCells.end(), by_surface);
+
+  bodyForces.assign(bodyCount, Vector2());
+  bodyForceOrigins.assign(bodyCount, Vector2());
+  std::vector<int> &moved = displacementFound; // reused as a per body counter
+  std::fill(moved.begin(), moved.end(), 0);
+
+  size_t f = 0;
+  for (const DisplacedCell &d : displacedCells)
+  {
+    while (f < freeCells.size() && freeCells[f].body < d.body)
+      f++;
+    if (f >= freeCells.size() || freeCells[f].body != d.body)
+      continue; // nowhere to go, stays under the body this tick
+    Vector2i to = freeCells[f++].cell;
+
+    Vector2 body_center = bodyStates[d.body].transform.get_origin();
+    Vector2 from = Vector2(d.cell.x, d.cell.y);
+    Vector2 out = (Vector2(to.x, to.y) - body_center).normalized();
+
+    Particle *p = get_particle(d.cell.x, d.cell.y);
+    if (p != nullptr)
+    {
+      p->set_cell(to.x, to.y);
+      p->velocity = out * 2.0f;
+      p->set_active(true);
+      bodyForces[d.body] += (body_center - from).normalized() * (p->type == Water::TYPE ? 20.0f : 40.0f);
+    }
+    else
+    {
+      margolus.data()[d.cell.y * width + d.cell.x] = MargolusGrid::EMPTY;
+      margolus.data()[to.y * width + to.x] = MargolusGrid::GRAIN;
+      clear_cell(d.cell.x, d.cell.y);
+      set_static_cell(to.x, to.y, Sand::TYPE);
+      bodyForces[d.body] += (body_center - from).normalized() * 40.0f;
+    }
+    bodyForceOrigins[d.body] += from;
+    moved[d.body]++;
+  }
+}
+
+void SandEngine::apply_body_forces()
+{
+  // one aggregated push per body, applied at the centroid of what it displaced
+  for (size_t b = 0; b < bodyForces.size() && b < rigidBodies.size(); b++)
+  {
+    int moved = displacementFound[b];
+    if (moved == 0)
+      continue;
+
+    RigidBody2D *rb = rigidBodies[b];
+    Vector2 relPos = rb->get_global_transform().xform_inv(bodyForceOrigins[b] / (float)moved);
+    rb->apply_force(bodyForces[b], relPos);
+    // ensure max vel
+    rb->set_linear_velocity(rb->get_linear_velocity().clamp(Vector2(-10, -10), Vector2(10, 10)));
+    rb->set_angular_velocity(CLAMP(rb->get_angular_velocity(), -2.0f, 2.0f));
+  }
+  bodyForces.clear();
+}
+
+void SandEngine::set_debris_enabled(bool enabled)
+{
+  // labels are not kept up to date while disabled
+  if (enabled && !debrisEnabled && initialized)
+    structure.reset(width, height, chunksX, chunksY, CHUNK_SIZE);
+  debrisEnabled = enabled;
+}
+
+void SandEngine::set_debris_anchor_mask(int mask)
+{
+  structure.anchorMask = (uint32_t)mask;
+  if (initialized)
+    structure.reset(width, height, chunksX, chunksY, CHUNK_SIZE);
+}
+
+DebrisPiece *SandEngine::find_debris(RigidBody2D *body)
+{
+  for (DebrisPiece &piece : debris)
+  {
+    if (piece.body == body)
+      return &piece;
+  }
+  return nullptr;
+}
+
+// same colors as overlay_compute.glsl
+static Color material_color(uint32_t type)
+{
+  if (type == Sand::TYPE)
+    return Color(1.0f, 1.0f, 0.0f, 1.0f);
+  if (type == Water::TYPE)
+    return Color(0.0f, 0.0f, 1.0f, 0.4f);
+  if (type == Water::FOAM_TYPE)
+    return Color(0.5f, 0.5f, 1.0f, 0.6f);
+  float shade = 0.35f + 0.05f * (float)(type % 8);
+  return Color(shade, shade, shade, 1.0f);
+}
+
+void SandEngine::detect_debris()
+{
+  if (!structure.has_dirty())
+    return;
+
+  structure.update(this, detachedCells, debrisMinCells, debrisMaxCells);
+  for (const std::vector<Vector2i> &cut : detachedCells)
+  {
+    Vector2i lo = cut[0];
+    Vector2i hi = cut[0];
+    for (const Vector2i &c : cut)
+    {
+      lo = Vector2i(MIN(lo.x, c.x), MIN(lo.y, c.y));
+      hi = Vector2i(MAX(hi.x, c.x), MAX(hi.y, c.y));
+    }
+
+    DebrisPiece piece;
+    piece.origin = lo;
+    piece.size = hi - lo + Vector2i(1, 1);
+    piece.types.assign(piece.size.x * piece.size.y, 0);
+    piece.cells = (int)cut.size();
+    for (const Vector2i &c : cut)
+    {
+      piece.types[(c.y - lo.y) * piece.size.x + (c.x - lo.x)] = get_cell(c.x, c.y)->type;
+      erase_cell(c.x, c.y);
+    }
+    // the body is created on the main thread in end_tick
+    debris.push_back(std::move(piece));
+  }
+}
+
+void SandEngine::spawn_debris()
+{
+  Node *parent = get_parent() != nullptr ? get_parent() : this;
+
+  for (size_t i = 0; i < debris.size();)
+  {
+    DebrisPiece &piece = debris[i];
+    if (piece.body != nullptr)
+    {
+      i++;
+      continue;
+    }
+
+    Ref<BitMap> mask;
+    mask.instantiate();
+    mask->create(piece.size);
+    Ref<Image> image = Image::create_empty(piece.size.x, piece.size.y, false, Image::FORMAT_RGBA8);
+    for (int y = 0; y < piece.size.y; y++)
+    {
+      for (int x = 0; x < piece.size.x; x++)
+      {
+        uint32_t type = piece.types[y * piece.size.x + x];
+        if (type == 0)
+          continue;
+        mask->set_bit(x, y, true);
+        image->set_pixel(x, y, material_color(type));
+      }
+    }
+
+    Array polygons = mask->opaque_to_polygons(Rect2i(Vector2i(), piece.size), 1.0f);
+    if (polygons.size() == 0)
+    {
+      // too thin to get an outline, the cells go back where they were
+      for (int y = 0; y < piece.size.y; y++)
+      {
+        for (int x = 0; x < piece.size.x; x++)
+        {
+          uint32_t type = piece.types[y * piece.size.x + x];
+          if (type != 0 && type_at(piece.origin.x + x, piece.origin.y + y) == 0)
+            set_static_cell(piece.origin.x + x, piece.origin.y + y, type);
+        }
+      }
+      debris.erase(debris.begin() + i);
+      continue;
+    }
+
+    // the body origin is the center of the box, the polygons come in bitmap pixels
+    Vector2 half = Vector2((float)piece.size.x, (float)piece.size.y) * 0.5f;
+    RigidBody2D *body = memnew(RigidBody2D);
+    for (int64_t p = 0; p < polygons.size(); p++)
+    {
+      PackedVector2Array polygon = polygons[p];
+      for (int64_t v = 0; v < polygon.size(); v++)
+        polygon.set(v, polygon[v] - half);
+
+      CollisionPolygon2D *shape = memnew(CollisionPolygon2D);
+      shape->set_polygon(polygon);
+      body->add_child(shape);
+    }
+
+    Sprite2D *sprite = memnew(Sprite2D);
+    sprite->set_texture(ImageTexture::create_from_image(image));
+    sprite->set_texture_filter(CanvasItem::TEXTURE_FILTER_NEAREST);
+    body->add_child(sprite);
+
+    body->set_mass(MAX(piece.cells * 0.01f, 0.1f)); // one unit per hundred cells
+    parent->add_child(body);
+    body->set_global_position(Vector2((float)piece.origin.x, (float)piece.origin.y) + half);
+
+    piece.body = body;
+    rigidBodies.push_back(body);
+    i++;
+  }
+}
+
+void SandEngine::rasterize_debris(int body, DebrisPiece &piece)
+{
+  const Transform2D &transform = bodyStates[body].transform;
+  Vector2 half = Vector2((float)piece.size.x, (float)piece.size.y) * 0.5f;
+  piece.contact = DEBRIS_FALLING;
+
+  // half cell steps like the rectangles, so a rotated piece leaves no gaps
+  for (int sy = 0; sy < piece.size.y * 2; sy++)
+  {
+    for (int sx = 0; sx < piece.size.x * 2; sx++)
+    {
+      if (piece.types[(sy / 2) * piece.size.x + sx / 2] == 0)
+        continue;
+
+      Vector2 point = transform.xform(Vector2((sx + 0.5f) * 0.5f, (sy + 0.5f) * 0.5f) - half);
+      int grid_x = static_cast<int>(point.x);
+      int grid_y = static_cast<int>(point.y);
+      if (grid_x < 0 || grid_y < 0 || grid_x >= width || grid_y >= height)
+        continue;
+
+      uint32_t type = cells[gridIndex(grid_x, grid_y)].type;
+      if (structure.is_solid(type))
+      {
+        piece.contact = DEBRIS_SINKING;
+      }
+      else if (piece.contact == DEBRIS_FALLING)
+      {
+        uint32_t below = grid_y + 1 < height ? cells[gridIndex(grid_x, grid_y + 1)].type : 0;
+        if (grid_y + 1 == height || structure.is_solid(below) || structure.is_support(below))
+          piece.contact = DEBRIS_RESTING;
+      }
+      occupy_cell(grid_x, grid_y, body);
+    }
+  }
+}
+
+void SandEngine::settle_debris()
+{
+  for (size_t i = 0; i < debris.size();)
+  {
+    DebrisPiece &piece = debris[i];
+    RigidBody2D *body = piece.body;
+    if (body == nullptr)
+    {
+      i++;
+      continue;
+    }
+
+    // the rotated box of the piece, in cells
+    Transform2D transform = body->get_global_transform();
+    Vector2 half = Vector2((float)piece.size.x, (float)piece.size.y) * 0.5f;
+    Vector2 corners[4] = {
+        transform.xform(-half),
+        transform.xform(Vector2(half.x, -half.y)),
+        transform.xform(Vector2(-half.x, half.y)),
+        transform.xform(half)};
+    Vector2 lo = corners[0];
+    Vector2 hi = corners[0];
+    for (const Vector2 &c : corners)
+    {
+      lo = Vector2(MIN(lo.x, c.x), MIN(lo.y, c.y));
+      hi = Vector2(MAX(hi.x, c.x), MAX(hi.y, c.y));
+    }
+
+    // a piece that left the grid never touches anything to settle on, it is dropped
+    bool outside = hi.x < 0.0f || hi.y < 0.0f || lo.x >= (float)width || lo.y >= (float)height;
+    if (!outside)
+    {
+      if (debrisSettleTicks == 0)
+      {
+        i++;
+        continue;
+      }
+
+      bool still = body->is_sleeping() || (body->get_linear_velocity().length() < 2.0f && Math::abs(body->get_angular_velocity()) < 0.1f);
+      piece.quietTicks = still && piece.contact != DEBRIS_FALLING ? piece.quietTicks + 1 : 0;
+
+      // a piece that fell into terrain turns back right away, the grid has no collision shapes to stop it
+      if (piece.contact != DEBRIS_SINKING && piece.quietTicks < debrisSettleTicks)
+      {
+        i++;
+        continue;
+      }
+    }
+
+    // sample the piece at every grid cell its rotated box covers, cells that are taken are lost
+    int x0 = MAX((int)Math::floor(lo.x), 0);
+    int y0 = MAX((int)Math::floor(lo.y), 0);
+    int x1 = MIN((int)Math::ceil(hi.x), width - 1);
+    int y1 = MIN((int)Math::ceil(hi.y), height - 1);
+    for (int y = y0; y <= y1; y++)
+    {
+      for (int x = x0; x <= x1; x++)
+      {
+        Vector2 local = transform.xform_inv(Vector2(x + 0.5f, y + 0.5f)) + half;
+        int lx = (int)Math::floor(local.x);
+        int ly = (int)Math::floor(local.y);
+        if (lx < 0 || ly < 0 || lx >= piece.size.x || ly >= piece.size.y)
+          continue;
+
+        uint32_t type = piece.types[ly * piece.size.x + lx];
+        if (type != 0 && cells[gridIndex(x, y)].type == 0)
+          set_static_cell(x, y, type);
+      }
+    }
+
+    rigidBodies.erase(std::find(rigidBodies.begin(), rigidBodies.end(), body));
+    body->queue_free();
+    debris.erase(debris.begin() + i);
+  }
+}
+
+void SandEngine::_physics_process(double delta)
+{
+  if (Engine::get_singleton()->is_editor_hint() || externalStepping)
+    return;
+
+  begin_tick(delta);
+  simulate_tick();
+  end_tick();
+}
+
+void SandEngine::begin_tick(double delta)
+{
+  frame++;
+  tickDelta = delta;
+
+  tracer.begin_frame(frame);
+  SAND_TRACE_ZONE_ARG(tracer, "begin_tick", "frame", frame);
+
+  // shuffle active particles
+  // std::vector<uint32_t> shuffled(active_particles.begin(), active_particles.end());
+  // std::shuffle(shuffled.begin(), shuffled.end(), std::default_random_engine(frame)); // shuffle
+
+  // clear rigidbodies
+  memset(rigidyBodyOccupancy.data(), 0, rigidyBodyOccupancy.size() * sizeof(int));
+  occupiedCells.swap(lastOccupiedCells);
+  occupiedCells.clear();
+
+  // clear debug
+  {
+    SAND_TRACE_ZONE(tracer, "clear_debug");
+    for (size_t i = 0; i < cells.size(); i++)
+    {
+      cells[i].debug[0] = -1;
+      cells[i].debug[1] = -1;
+      cells[i].debug[2] = -1;
+    }
+  }
+
+  if (!debris.empty())
+  {
+    SAND_TRACE_ZONE(tracer, "settle_debris");
+    settle_debris();
+  }
+
+  {
+    SAND_TRACE_ZONE(tracer, "rigid_body_scan");
+    rasterize_rigid_bodies();
+
+    // a cell a body moved off is no longer a wall, wake what rests against it (e.g. a dammed lake)
+    for (const Vector2i &c : lastOccupiedCells)
+    {
+      if (rigidyBodyOccupancy[gridIndex(c.x, c.y)] == 0)
+      {
+        touch_chunks(c.x, c.y);
+        wake_neighbors(c.x, c.y);
+      }
+    }
+  }
+}
+
+void SandEngine::simulate_tick()
+{
+  SAND_TRACE_ZONE_ARG(tracer, "simulate_tick", "frame", frame);
+  double delta = tickDelta;
+
+  // before anything draws random numbers (emitters, the update order, reactions)
+  if (deterministic)
+    seed_tick();
+
+  {
+    SAND_TRACE_ZONE(tracer, "displace_overlapped_cells");
+    displace_overlapped_cells();
+  }
+
+  {
+    SAND_TRACE_ZONE(tracer, "update_chunk_lod");
+    update_chunk_lod();
+  }
+
+  if (!emitters.empty())
+  {
+    SAND_TRACE_ZONE(tracer, "emitters");
+    run_emitters();
+  }
+
+  {
+    SAND_TRACE_ZONE(tracer, "update_particles");
+    // particles can wake or sleep others while updating, so iterate a copy
+    updateQueue.assign(active_particles.begin(), active_particles.end());
+    if (deterministic)
+      shuffle_update_queue();
+
+    // With a budget the queue is walked round robin from where the last over budget tick
+    // stopped, particles that miss a tick make up for it through their elapsed ticks.
+    size_t count = updateQueue.size();
+    size_t start = 0;
+    bool useBudget = tickBudgetUsec > 0 && !deterministic; // wall clock time differs between peers
+    if (useBudget && count > 0)
+      start = budgetCursor % count;
+    std::chrono::steady_clock::time_point tickStart = std::chrono::steady_clock::now();
+    int maxElapsed = get_max_elapsed_ticks();
+
+    lastTickUpdates = 0;
+    budgetBacklog = 0;
+    budgetCursor = 0;
+    size_t n = 0;
+    while (n < count)
+    {
+      // gather the next batch of due particles
+      batchIds.clear();
+      batchDelta.clear();
+      sandBatch.clear();
+      waterBatch.clear();
+      for (; n < count && batchIds.size() < UPDATE_BATCH_SIZE; n++)
+      {
+        size_t qi = start + n < count ? start + n : start + n - count;
+        Particle *p = particles[updateQueue[qi]];
+        if (p == nullptr)
+          continue;
+
+        int chunk = chunkIndex(p->cell.x, p->cell.y);
+        if (!chunks[chunk].updateThisTick)
+          continue;
+
+        // particles in far chunks, or ones the budget deferred, cover the ticks they skipped in one update
+        int elapsed = CLAMP(frame - p->lastUpdateFrame, 1, maxElapsed);
+        p->lastUpdateFrame = frame;
+        double dt = delta * elapsed;
+
+        Vector2 force;
+        if (forceFields.affects_chunk(chunk))
+        {
+          force = forceFields.sample(chunk, p->cell.x, p->cell.y) * (float)dt;
+          // a pushed particle keeps its chunk out of LOD freezing
+          if (force != Vector2())
+            chunks[chunk].touched = true;
+        }
+
+        if (p->type == Sand::TYPE)
+          sandBatch.push(p->id, p->velocity, force, (float)dt);
+        else if (p->type == Water::TYPE)
+          waterBatch.push(p->id, p->velocity, force, (float)dt);
+        else
+          p->velocity += force;
+
+        batchIds.push_back(p->id);
+        batchDelta.push_back(dt);
+      }
+
+      {
+        SAND_TRACE_ZONE(tracer, "integrate_batch");
+        Sand::integrate_batch(sandBatch, restingVelocity);
+        Water::integrate_batch(waterBatch, restingVelocity);
+        scatter_velocities(sandBatch);
+        scatter_velocities(waterBatch);
+      }
+
+      // movement resolution, in queue order
+      for (size_t i = 0; i < batchIds.size(); i++)
+      {
+        Particle *p = particles[batchIds[i]];
+        if (p != nullptr)
+          p->update(batchDelta[i]);
+      }
+      lastTickUpdates += (int)batchIds.size();
+
+      // the clock is only checked between batches, per particle it would cost more than some updates
+      if (useBudget && n < count)
+      {
+        int64_t spent = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - tickStart).count();
+        if (spent > tickBudgetUsec)
+        {
+          budgetCursor = start + n < count ? start + n : start + n - count;
+          budgetBacklog = (int)(count - n);
+          break;
+        }
+      }
+    }
+  }
+
+  if (!emitters.empty())
+  {
+    SAND_TRACE_ZONE(tracer, "drains");
+    run_drains();
+  }
+
+  if (liquidSpans)
+  {
+    SAND_TRACE_ZONE(tracer, "liquid_spans");
+    solve_liquids();
+  }
+
+  if (!reactions.empty())
+  {
+    SAND_TRACE_ZONE(tracer, "reactions");
+    react();
+  }
+
+  step_margolus();
+
+  if (debrisEnabled)
+  {
+    SAND_TRACE_ZONE(tracer, "detect_debris");
+    detect_debris();
+  }
+
+  if (debugMode != ParticleDebugMode::NONE)
+  {
+    SAND_TRACE_ZONE(tracer, "debug_pass");
+    for (Particle *p : particles)
+    {
+      if (p != nullptr)
+        p->update_debug();
+    }
+  }
+}
+
+void SandEngine::end_tick()
+{
+  SAND_TRACE_ZONE_ARG(tracer, "end_tick", "frame", frame);
+  apply_body_forces();
+  spawn_debris();
   update_ssbo();
+  emit_sensor_changes();
+  emit_events();
+}
+
+struct EngineBatch
+{
+  std::vector<SandEngine *> engines;
+};
+
+static void simulate_engine(void *userdata, uint32_t index)
+{
+  EngineBatch *batch = static_cast<EngineBatch *>(userdata);
+  batch->engines[index]->simulate_tick();
+}
+
+void SandEngine::step_engines(const Array &engines, double delta)
+{
+  EngineBatch batch;
+  for (int64_t i = 0; i < engines.size(); i++)
+  {
+    Object *object = engines[i];
+    SandEngine *engine = Object::cast_to<SandEngine>(object);
+    if (engine == nullptr || !engine->initialized)
+      continue;
+    ERR_CONTINUE_MSG(!engine->externalStepping, "step_engines: engine does not have external_stepping set, it already steps itself");
+    // stepping an engine twice would simulate the same grid on two workers at once
+    if (std::find(batch.engines.begin(), batch.engines.end(), engine) != batch.engines.end())
+      continue;
+    batch.engines.push_back(engine);
+  }
+
+  // scene access (rigid bodies, signals, the render buffer) stays on the calling thread
+  for (SandEngine *engine : batch.engines)
+    engine->begin_tick(delta);
+
+  WorkerThreadPool *pool = WorkerThreadPool::get_singleton();
+  if (pool != nullptr && batch.engines.size() > 1)
+  {
+    // engines on pool threads run their automaton bands inline rather than nesting tasks
+    for (SandEngine *engine : batch.engines)
+      engine->onWorkerThread = true;
+    int64_t task = pool->add_native_group_task(&simulate_engine, &batch, (int)batch.engines.size(), -1, true, "SandEngine step_engines");
+    pool->wait_for_group_task_completion(task);
+  }
+  else
+  {
+    for (uint32_t i = 0; i < batch.engines.size(); i++)
+      simulate_engine(&batch, i);
+  }
+
+  for (SandEngine *engine : batch.engines)
+  {
+    engine->onWorkerThread = false;
+    engine->end_tick();
+  }
 }
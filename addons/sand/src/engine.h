@@ -1,9 +1,18 @@
 #pragma once
 
 #include <vector>
-#include <map>
-#include <set>
 #include "particles/particle.h"
+#include "trace.h"
+#include "margolus.h"
+#include "sensors.h"
+#include "force_fields.h"
+#include "liquid.h"
+#include "grid_layout.h"
+#include "reactions.h"
+#include "structure.h"
+#include "state_hash.h"
+#include "emitters.h"
+#include "events.h"
 #include <godot_cpp/classes/node2d.hpp>
 #include <functional>
 #include <memory>
@@ -11,11 +20,6 @@
 namespace godot
 {
 
-  // Static Opts
-  static int MAX_PARTICLES = 100000;
-
-  static int frame = 0;
-
   enum ParticleDebugMode
   {
     NONE = 0,
@@ -37,6 +41,61 @@ namespace godot
 
   static_assert(sizeof(Cell) == 16, "Cell struct must be 16 bytes in size");
 
+  struct BodyState
+  {
+    Transform2D transform;
+    Vector2 velocity;
+  };
+
+  struct DisplacedCell
+  {
+    Vector2i cell;
+    int body; // index into rigidBodies
+  };
+
+  enum DebrisContact
+  {
+    DEBRIS_FALLING = 0,
+    DEBRIS_RESTING = 1, // on top of grid material
+    DEBRIS_SINKING = 2, // overlapping static solids
+  };
+
+  // a piece of terrain that lost its support, simulated as a rigid body until it comes to rest
+  struct DebrisPiece
+  {
+    RigidBody2D *body = nullptr; // created in end_tick
+    Vector2i origin;             // top left cell of the box the piece was cut from
+    Vector2i size;
+    std::vector<uint32_t> types; // per cell of the box, 0 where the piece has no cell
+    int cells = 0;
+    int quietTicks = 0;
+    uint8_t contact = DEBRIS_FALLING; // as of the last rasterize
+  };
+
+  // The grid is split into square chunks, the unit for simulation level of detail
+  static const int CHUNK_SIZE = 32;
+
+  enum GranularMode
+  {
+    GRANULAR_PARTICLES = 0, // sand is simulated as Sand particles
+    GRANULAR_MARGOLUS = 1,  // sand is placed into the block automaton, particles keep the other materials
+  };
+
+  enum ChunkLod
+  {
+    LOD_NEAR = 0,   // inside the view plus margin, updated every tick
+    LOD_FAR = 1,    // updated every lodFarInterval ticks with scaled time
+    LOD_FROZEN = 2, // far away and settled, not updated until touched or seen
+  };
+
+  struct Chunk
+  {
+    uint8_t lod = LOD_NEAR;
+    bool updateThisTick = true;
+    bool touched = false;      // a cell in or next to the chunk changed since its last update
+    uint16_t quietUpdates = 0; // consecutive updates where nothing changed
+  };
+
   class SandEngine : public Node2D
   {
     GDCLASS(SandEngine, Node2D)
@@ -45,17 +104,223 @@ namespace godot
     RID ssbo_rid;
     int height = 300;
     int width = 800;
+    int maxParticles = 100000;
+    bool initialized = false; // storage allocated in _ready
+
+    int frame = 0;
+    // tuning shared by every particle of this engine
+    float restingVelocity = 0.1f; // particles slower than this stop
+    float flowViscosity = 15.0f;  // how quickly water turns towards its flow direction
+
+    int particleCount = 0;
+    int reservedParticles = 0; // slots allocated so far, only grows
+    int refusedSpawns = 0;     // spawns rejected because maxParticles was reached
 
     ParticleDebugMode debugMode = ParticleDebugMode::VELOCITY;
 
+    GridLayout layout; // storage order of cells, cellData and rigidyBodyOccupancy
     std::vector<Cell> cells;
     std::vector<CellInfo> cellData;
     std::vector<RigidBody2D *> rigidBodies;
     std::vector<int> rigidyBodyOccupancy;
-    std::map<uint32_t, Particle *> particle_map; // map from particle id -> particle
-    std::set<uint32_t> active_particles;
+    std::vector<Vector2i> occupiedCells;     // cells rigidyBodyOccupancy marks this tick
+    std::vector<Vector2i> lastOccupiedCells; // and last tick, so cells a body left can wake what rests on them
+    // Particles are constructed in place into fixed size blocks, a particle's id is its slot.
+    // Everything is reserved up front (see reserve_particles) so spawning never allocates mid-game.
+    std::vector<std::unique_ptr<uint8_t[]>> particleBlocks;
+    std::vector<Particle *> particles;    // particle id -> particle, nullptr for free slots
+    std::vector<uint32_t> freeIds;        // free slots, lowest id on top
+    std::vector<uint32_t> active_particles;
+    std::vector<int32_t> activeIndex;     // particle id -> index in active_particles, -1 when inactive
+    std::vector<uint32_t> updateQueue;    // per tick copy of active_particles
+
+    // The update runs in batches: velocities of a batch are integrated per material in one
+    // vectorized pass (see Sand::integrate_batch), then each particle resolves its movement
+    static const size_t UPDATE_BATCH_SIZE = 256;
+    std::vector<uint32_t> batchIds;
+    std::vector<double> batchDelta;
+    VelocityBatch sandBatch;
+    VelocityBatch waterBatch;
+    void scatter_velocities(const VelocityBatch &batch)
+    {
+      for (int i = 0; i < batch.size(); i++)
+        particles[batch.ids[i]]->velocity = Vector2(batch.vx[i], batch.vy[i]);
+    }
+    Tracer tracer;
+
+    std::vector<Chunk> chunks;
+    int chunksX = 0;
+    int chunksY = 0;
+    double tickDelta = 1.0 / 60.0;
+    int lastTickUpdates = 0;
+
+    // level of detail, driven by the view rect the renderer reports every frame
+    Rect2i viewRect;
+    bool lodEnabled = true;
+    int lodMargin = 64;          // cells around the view that still update every tick
+    int lodFarInterval = 4;      // far chunks update every N ticks
+    int lodFreezeDistance = 256; // settled chunks further than this from the view are frozen
+    int lodSettleUpdates = 8;    // updates without change before a chunk counts as settled
+    void update_chunk_lod();
+
+    // optional time budget for the particle update, 0 updates everything every tick
+    int tickBudgetUsec = 0;
+    int budgetMaxCatchUp = 4; // most ticks a deferred particle makes up in one update
+    size_t budgetCursor = 0;  // where the next tick resumes in the update queue
+    int budgetBacklog = 0;    // particles due last tick that did not fit in the budget
+
+    // high throughput sand, see margolus.h
+    GranularMode granularMode = GRANULAR_PARTICLES;
+    MargolusGrid margolus;
+    bool hasGrains = false;
+    uint32_t margolusStep = 0;
+    void step_margolus();
+    static void step_margolus_band(void *userdata, uint32_t band);
+
+    // Rigid bodies are rasterized into rigidyBodyOccupancy every tick, whatever they overlap
+    // is moved to nearby free cells in one batched pass
+    std::vector<DisplacedCell> displacedCells;
+    std::vector<DisplacedCell> freeCells;
+    std::vector<DisplacedCell> bfsQueue;
+    std::vector<uint32_t> cellVisit; // per cell stamp, avoids clearing a visited grid per search
+    uint32_t visitStamp = 0;
+    std::vector<int> displacementNeeded;
+    std::vector<int> displacementFound;
+    std::vector<Vector2i> neighborOrder;
+    std::vector<Vector2> bodyForces;
+    std::vector<Vector2> bodyForceOrigins;
+    std::vector<BodyState> bodyStates; // copied in rasterize_rigid_bodies
+    void rasterize_rigid_bodies();
+    void rasterize_debris(int body, DebrisPiece &piece);
+    void occupy_cell(int x, int y, int body);
+    void displace_overlapped_cells();
+    void apply_body_forces();
+
+    // the tick is split so that only simulate_tick runs off the main thread, see step_engines
+    bool externalStepping = false;
+    bool onWorkerThread = false; // simulate_tick is already on a pool thread, do not nest tasks
+    void begin_tick(double delta);
+    void end_tick();
+
+    // bulk levelling of water bodies, see liquid.h
+    bool liquidSpans = true;
+    LiquidSolver liquid;
+    std::vector<Particle *> liquidSeeds;
+    void solve_liquids();
+
+    ForceFieldSet forceFields;
+    void wake_force_field(int id);
+
+    EmitterSet emitters;
+    void run_emitters();
+    void run_drains();
+    bool emit_cell(const int x, const int y, const EmitterSet::Emitter &emitter);
+
+    // static solids that lose their support are cut out into rigid bodies, see structure.h
+    bool debrisEnabled = false;
+    int debrisMinCells = 4;     // smaller pieces stay where they are
+    int debrisMaxCells = 4096;  // larger ones too, they count as part of the level
+    int debrisSettleTicks = 30; // ticks at rest on the grid before a piece turns back into cells, 0 never
+    StructureGraph structure;
+    std::vector<std::vector<Vector2i>> detachedCells;
+    std::vector<DebrisPiece> debris;
+    void detect_debris();
+    void spawn_debris();
+    void settle_debris();
+    DebrisPiece *find_debris(RigidBody2D *body);
+
+    // marks the pieces a cell change may have cut loose or propped up
+    void mark_structure(const int x, const int y, uint32_t oldType, uint32_t newType)
+    {
+      if (structure.is_solid(oldType) || structure.is_solid(newType))
+        structure.mark_dirty(chunkIndex(x, y));
+      else if (y > 0 && (structure.is_support(oldType) || structure.is_support(newType)) && structure.is_solid(cells[gridIndex(x, y - 1)].type))
+        structure.mark_dirty(chunkIndex(x, y - 1));
+    }
+
+    // material reactions, evaluated on the frontier the cell change hook maintains
+    ReactionSet reactions;
+    std::vector<Vector2i> reactingCells;
+    int lastTickReactions = 0;
+    void react();
+    void rebuild_reaction_frontier();
+    void apply_reaction(const Vector2i &cell, const Vector2i &other, const ReactionSet::Rule &rule, bool swapped);
+    void replace_cell(const int x, const int y, uint32_t type);
+
+    // marks cell and its neighbours for reaction if the new type reacts with any of them
+    void mark_reactions(const int x, const int y, uint32_t type)
+    {
+      static const int dx[4] = {1, -1, 0, 0};
+      static const int dy[4] = {0, 0, 1, -1};
+      for (int k = 0; k < 4; k++)
+      {
+        Cell *neighbor = get_cell(x + dx[k], y + dy[k]);
+        if (neighbor == nullptr || !reactions.reacts(type, neighbor->type))
+          continue;
+        reactions.mark(gridIndex(x, y), Vector2i(x, y));
+        reactions.mark(gridIndex(x + dx[k], y + dy[k]), Vector2i(x + dx[k], y + dy[k]));
+      }
+    }
+
+    // simulation random numbers (xorshift32)
+    uint32_t rngState = 0x2545F491u;
+    uint32_t next_random()
+    {
+      uint32_t x = rngState;
+      x ^= x << 13;
+      x ^= x >> 17;
+      x ^= x << 5;
+      return rngState = x;
+    }
+    float random_unit() { return (next_random() >> 8) * (1.0f / 16777216.0f); }
+
+    // lockstep: randomness and update order are seeded per tick, chunk hashes follow every cell change
+    bool deterministic = false;
+    int64_t deterministicSeed = 0;
+    StateHash stateHash;
+    void seed_tick();
+    void shuffle_update_queue();
+    void reset_state_hash();
+
+    // particle events for audio and effects, delivered once per tick by the events_emitted signal
+    bool eventsEnabled = false;
+    float eventMinSpeed = 1.0f; // slower impacts and splashes are not logged
+    EventLog events;
+    std::vector<EventLog::Group> eventGroups;
+    void emit_events();
+
+    SensorSet sensors;
+    std::vector<int> changedSensors;
+    void emit_sensor_changes();
+    uint32_t type_at(int x, int y) const;
+
+    // every change of a cell's material goes through here
+    void cell_type_changed(const int x, const int y, uint32_t oldType, uint32_t newType)
+    {
+      if (oldType == newType)
+        return;
+      sensors.on_cell_changed(chunkIndex(x, y), x, y, oldType, newType);
+      if (deterministic)
+        stateHash.on_cell_changed(chunkIndex(x, y), x, y, oldType, newType);
+      if (!reactions.empty())
+        mark_reactions(x, y, newType);
+      if (debrisEnabled)
+        mark_structure(x, y, oldType, newType);
+    }
+
+    // character collision queries, see move_and_collide
+    uint32_t solidMask = ~((1u << 0) | (1u << 2) | (1u << 3)); // bit per material, empty, water and foam are passable
+    bool solidOutsideGrid = false;
+    int column_ground(int x, int from_y, int max_depth) const;
+    float sweep_box_axis(Rect2 &box, float motion, int axis, Vector2 &normal) const;
+    Vector2 resolve_box_penetration(Rect2 &box) const;
+
     void create_ssbo();
     void update_ssbo();
+    void allocate_grid();
+    void reserve_particles(int capacity);
+    void resize_grid(int new_width, int new_height);
+    Particle *construct_particle(uint32_t id, const Vector2i &cell, uint32_t type);
 
   protected:
     static void _bind_methods();
@@ -68,12 +333,170 @@ namespace godot
     void for_each_along_line(const Vector2i &from, const Vector2i &to, const std::function<bool(const int &, const Vector2i &)> &callback) const;
 
     void _physics_process(double delta) override;
+    // grid only part of the tick, touches nothing outside this engine
+    void simulate_tick();
+
+    // Steps several engines at once, the simulation of each on its own worker thread. Engines
+    // stepped this way should have external_stepping set so they do not also step themselves.
+    static void step_engines(const Array &engines, double delta);
+    bool get_external_stepping() const { return externalStepping; }
+    void set_external_stepping(bool enabled) { externalStepping = enabled; }
     void _draw() override;
     void _ready() override;
     RID get_ssbo_rid() const;
 
+    // Records the next frame_count ticks (starting at first_frame, or the next tick when -1)
+    // into a Chrome trace-event JSON file. Needs a build with `scons trace=yes`.
+    void capture_trace(const String &path, int frame_count, int first_frame);
+    bool is_capturing_trace() const { return tracer.is_armed(); }
+    Tracer &get_tracer() { return tracer; }
+
     int get_grid_width() const { return width; }
     int get_grid_height() const { return height; }
+    void set_grid_width(int w) { resize_grid(w, height); }
+    void set_grid_height(int h) { resize_grid(width, h); }
+
+    int get_frame() const { return frame; }
+    float get_resting_velocity() const { return restingVelocity; }
+    void set_resting_velocity(float velocity) { restingVelocity = MAX(velocity, 0.0f); }
+    float get_flow_viscosity() const { return flowViscosity; }
+    void set_flow_viscosity(float viscosity) { flowViscosity = MAX(viscosity, 0.0f); }
+
+    int get_max_particles() const { return maxParticles; }
+    void set_max_particles(int capacity);
+    int get_particle_count() const { return particleCount; }
+    int get_refused_spawns() const { return refusedSpawns; }
+    int get_last_tick_updates() const { return lastTickUpdates; }
+
+    // level of detail
+    void set_view_rect(const Rect2i &rect) { viewRect = rect; }
+    Rect2i get_view_rect() const { return viewRect; }
+    bool get_lod_enabled() const { return lodEnabled; }
+    void set_lod_enabled(bool enabled) { lodEnabled = enabled; }
+    int get_lod_margin() const { return lodMargin; }
+    void set_lod_margin(int margin) { lodMargin = MAX(margin, 0); }
+    int get_lod_far_interval() const { return lodFarInterval; }
+    void set_lod_far_interval(int interval) { lodFarInterval = MAX(interval, 1); }
+    int get_lod_freeze_distance() const { return lodFreezeDistance; }
+    void set_lod_freeze_distance(int distance) { lodFreezeDistance = MAX(distance, 0); }
+
+    // Deterministic mode for lockstep: no level of detail or tick budget, random numbers and the
+    // particle update order come from the seed and the frame. Hashes only cover cell materials.
+    bool get_deterministic() const { return deterministic; }
+    void set_deterministic(bool enabled);
+    int64_t get_deterministic_seed() const { return deterministicSeed; }
+    void set_deterministic_seed(int64_t seed) { deterministicSeed = seed; }
+    int64_t get_state_hash() const { return (int64_t)stateHash.world(); }
+    PackedInt64Array get_chunk_hashes() const;
+    // chunk coordinates whose hash differs from remote, a peer's get_chunk_hashes()
+    PackedVector2iArray find_desynced_chunks(const PackedInt64Array &remote) const;
+
+    bool get_liquid_spans() const { return liquidSpans; }
+    void set_liquid_spans(bool enabled) { liquidSpans = enabled; }
+
+    int get_granular_mode() const { return granularMode; }
+    void set_granular_mode(int mode) { granularMode = static_cast<GranularMode>(mode); }
+    // places a grain owned by the block automaton, independent of granular_mode
+    bool place_grain(const Vector2i &cell);
+
+    // reaction table, see reactions.h. Returns the rule id or -1 for invalid materials.
+    int add_reaction(int reactant_a, int reactant_b, int product_a, int product_b, float probability, int byproduct);
+    void clear_reactions();
+    int get_reaction_frontier_size() const { return (int)reactions.frontier_size(); }
+    int get_last_tick_reactions() const { return lastTickReactions; }
+
+    // sensors report per-material cell counts of a region through the sensors_changed signal
+    int add_sensor_rect(const Rect2i &rect);
+    int add_sensor_polygon(const PackedVector2Array &polygon);
+    void remove_sensor(int id);
+    PackedInt32Array get_sensor_counts(int id) const;
+
+    // force fields, evaluated for particles in the chunks they cover during the update
+    int add_wind_zone(const Rect2i &box, const Vector2 &acceleration);
+    int add_vortex(const Vector2 &center, float radius, float strength);
+    void remove_force_field(int id);
+    // Emitters spawn material into free cells of their area every tick, rate in cells per second.
+    // Sand and water become particles starting at velocity, other materials static cells.
+    int add_emitter(const Rect2i &area, int material, float rate, const Vector2 &velocity);
+    int add_circle_emitter(const Vector2 &center, float radius, int material, float rate, const Vector2 &velocity);
+    void remove_emitter(int id) { emitters.remove_emitter(id); }
+    void set_emitter_enabled(int id, bool enabled);
+    void set_emitter_rate(int id, float rate);
+    int64_t get_emitter_spawned(int id) const { return emitters.is_valid_emitter(id) ? emitters.emitters[id].spawned : 0; }
+    int64_t get_emitter_blocked(int id) const { return emitters.is_valid_emitter(id) ? emitters.emitters[id].blocked : 0; }
+    // drains remove particles and grains of the materials in material_mask inside their area, static cells stay
+    int add_drain(const Rect2i &area, int material_mask);
+    int add_circle_drain(const Vector2 &center, float radius, int material_mask);
+    void remove_drain(int id) { emitters.remove_drain(id); }
+    void set_drain_enabled(int id, bool enabled);
+    int64_t get_drain_removed(int id) const { return emitters.is_valid_drain(id) ? emitters.drains[id].removed : 0; }
+    // removes the particle or automaton grain in cell, false when there is none
+    bool remove_particle(const Vector2i &cell);
+
+    // one-shot push away from center, cells within carve_radius are removed. Returns affected cells.
+    int apply_radial_impulse(const Vector2 &center, float radius, float strength, float carve_radius);
+
+    // Collision queries against the grid for kinematic characters, in cell units. A material
+    // is solid when its bit is set in solid_mask, cells outside the grid only with solid_outside_grid
+    // (off by default, so characters can leave the grid and be left to the physics bodies).
+    uint32_t get_solid_mask() const { return solidMask; }
+    void set_solid_mask(uint32_t mask) { solidMask = mask & ~1u; } // empty cells never block
+    bool get_solid_outside_grid() const { return solidOutsideGrid; }
+    void set_solid_outside_grid(bool solid) { solidOutsideGrid = solid; }
+    bool is_solid(int x, int y) const
+    {
+      if (x < 0 || y < 0 || x >= width || y >= height)
+        return solidOutsideGrid;
+      uint32_t type = cells[gridIndex(x, y)].type;
+      return type < 32 && (solidMask >> type) & 1u;
+    }
+    bool is_region_solid(int x0, int y0, int x1, int y1) const;
+    // Moves box by motion, stopping at the first solid cell on each axis. A box that starts
+    // inside material is first pushed out. Returns position, travel, remainder, collided,
+    // normal and penetration.
+    Dictionary move_and_collide(const Rect2 &box, const Vector2 &motion) const;
+    // topmost solid y in the columns within max_depth below from_y, -1 when there is none
+    int get_ground_height(int x_min, int x_max, int from_y, int max_depth) const;
+    Vector2 get_ground_normal(int x_min, int x_max, int from_y, int max_depth) const;
+    // cells box has to rise to move one cell towards direction, -1 when it cannot within max_step
+    int probe_step(const Rect2 &box, int direction, int max_step) const;
+
+    bool get_debris_enabled() const { return debrisEnabled; }
+    void set_debris_enabled(bool enabled);
+    int get_debris_anchor_mask() const { return (int)structure.anchorMask; }
+    void set_debris_anchor_mask(int mask);
+    int get_debris_min_cells() const { return debrisMinCells; }
+    void set_debris_min_cells(int cells) { debrisMinCells = MAX(cells, 1); }
+    int get_debris_max_cells() const { return debrisMaxCells; }
+    void set_debris_max_cells(int cells) { debrisMaxCells = MAX(cells, 1); }
+    int get_debris_settle_ticks() const { return debrisSettleTicks; }
+    void set_debris_settle_ticks(int ticks) { debrisSettleTicks = MAX(ticks, 0); }
+    int get_debris_count() const { return (int)debris.size(); }
+
+    int get_tick_budget_usec() const { return tickBudgetUsec; }
+    void set_tick_budget_usec(int usec) { tickBudgetUsec = MAX(usec, 0); }
+    int get_budget_max_catch_up() const { return budgetMaxCatchUp; }
+    void set_budget_max_catch_up(int ticks) { budgetMaxCatchUp = MAX(ticks, 1); }
+    int get_budget_backlog() const { return budgetBacklog; }
+
+    double get_tick_delta() const { return tickDelta; }
+    // Skipped ticks beyond this are dropped, so a simulation that cannot keep up slows down
+    // instead of taking huge steps
+    int get_max_elapsed_ticks() const { return MAX(lodFarInterval, tickBudgetUsec > 0 ? budgetMaxCatchUp : 1); }
+    // how many ticks of movement a particle should cover given the delta it was updated with
+    float get_tick_scale(double delta) const { return (float)CLAMP(delta / tickDelta, 1.0, (double)get_max_elapsed_ticks()); }
+
+    int chunkIndex(const int x, const int y) const
+    {
+      return (y / CHUNK_SIZE) * chunksX + (x / CHUNK_SIZE);
+    }
+
+    Chunk *get_chunk(const int x, const int y)
+    {
+      if (x < 0 || y < 0 || x >= width || y >= height)
+        return nullptr;
+      return &chunks[chunkIndex(x, y)];
+    }
 
     int get_debug_mode()
     {
@@ -85,15 +508,35 @@ namespace godot
       debugMode = static_cast<ParticleDebugMode>(mode);
     }
 
+    bool get_events_enabled() const { return eventsEnabled; }
+    void set_events_enabled(bool enabled) { eventsEnabled = enabled; }
+    int get_events_capacity() const { return events.capacity(); }
+    void set_events_capacity(int capacity) { events.reserve(MAX(capacity, 1)); }
+    float get_events_min_speed() const { return eventMinSpeed; }
+    void set_events_min_speed(float speed) { eventMinSpeed = MAX(speed, 0.0f); }
+    int get_dropped_events() const { return events.last_dropped(); }
+
+    // called from the update path, impacts and splashes below events_min_speed are skipped
+    void log_event(SimEventType type, const Vector2i &cell, float speed)
+    {
+      if (!eventsEnabled || ((type == EVENT_IMPACT || type == EVENT_SPLASH) && speed < eventMinSpeed))
+        return;
+      events.push(type, chunkIndex(cell.x, cell.y), cell.x, cell.y, speed);
+    }
+
     void spawn_particle(const Vector2i &cell, uint32_t type);
+    // returns nullptr when the cell is taken or the particle capacity is reached
+    Particle *create_particle(const Vector2i &cell, uint32_t type);
 
     void register_rigid_body(RigidBody2D *body);
 
-    int gridIndex(const int x, const int y)
+    int gridIndex(const int x, const int y) const
     {
-      return y * width + x;
+      return layout.index(x, y);
     }
 
+    int get_grid_layout() const { return GRID_LAYOUT; }
+
     CellInfo *get_cell_info(const int x, const int y)
     {
       if (x < 0 || y < 0 || x >= width || y >= height)
@@ -125,18 +568,48 @@ namespace godot
       return get_cell_info(x, y)->particle;
     }
 
+    // marks the chunks around a changed cell so frozen or settled regions wake up
+    void touch_chunks(const int x, const int y)
+    {
+      int cx0 = MAX(x - 1, 0) / CHUNK_SIZE;
+      int cy0 = MAX(y - 1, 0) / CHUNK_SIZE;
+      int cx1 = MIN(x + 1, width - 1) / CHUNK_SIZE;
+      int cy1 = MIN(y + 1, height - 1) / CHUNK_SIZE;
+      for (int cy = cy0; cy <= cy1; cy++)
+        for (int cx = cx0; cx <= cx1; cx++)
+          chunks[cy * chunksX + cx].touched = true;
+    }
+
     void clear_cell(const int x, const int y)
     {
       Cell *oldCell = get_cell(x, y);
 
       if (oldCell != nullptr)
       {
+        touch_chunks(x, y);
+        cell_type_changed(x, y, oldCell->type, 0);
         CellInfo *oldCellInfo = get_cell_info(x, y);
         oldCell->debug[0] = -1;
         oldCell->debug[1] = -1;
         oldCell->debug[2] = -1;
         oldCell->type = 0;
         oldCellInfo->particle = nullptr;
+        wake_neighbors(x, y); // includes sleeping liquid that had this cell as a wall
+      }
+    }
+
+    // a cell with a material but no particle, e.g. automaton grains
+    void set_static_cell(const int x, const int y, uint32_t type)
+    {
+      Cell *newCell = get_cell(x, y);
+
+      if (newCell != nullptr)
+      {
+        touch_chunks(x, y);
+        cell_type_changed(x, y, newCell->type, type);
+        newCell->type = type;
+        get_cell_info(x, y)->particle = nullptr;
+        wake_neighbors(x, y);
       }
     }
 
@@ -146,38 +619,90 @@ namespace godot
 
       if (newCell != nullptr)
       {
+        touch_chunks(x, y);
         CellInfo *newCellInfo = get_cell_info(x, y);
 
         newCell->debug[0] = -1;
         newCell->debug[1] = -1;
         newCell->debug[2] = -1;
 
+        cell_type_changed(x, y, newCell->type, particle->type);
         newCell->type = particle->type;
         newCellInfo->particle = particle;
       }
     }
 
+    // Moves the sand particles in rows top..bottom of column x down by shift empty cells. Only
+    // the cells at both ends change material, the rest just get their particle pointers moved.
+    void shift_column(const int x, const int top, const int bottom, const int shift);
+
+    void wake_neighbors(const int x, const int y)
+    {
+      for (int dy = -1; dy <= 1; dy++)
+      {
+        for (int dx = -1; dx <= 1; dx++)
+        {
+          Particle *neighbor = get_particle(x + dx, y + dy);
+          if (neighbor != nullptr && !neighbor->active)
+            neighbor->set_active(true);
+        }
+      }
+    }
+
+    // removes whatever occupies a cell: a particle, an automaton grain or a static cell
+    void erase_cell(const int x, const int y)
+    {
+      Particle *p = get_particle(x, y);
+      if (p != nullptr)
+      {
+        delete_particle(p);
+      }
+      else if (get_cell(x, y) != nullptr)
+      {
+        uint8_t &state = margolus.data()[y * width + x];
+        if (state == MargolusGrid::GRAIN)
+          state = MargolusGrid::EMPTY;
+        clear_cell(x, y); // wakes the neighbours
+      }
+    }
+
     void add_particle(const int x, const int y, Particle *particle)
     {
-      particle_map[particle->id] = particle;
-      active_particles.insert(particle->id);
+      particles[particle->id] = particle;
+      particleCount++;
+      set_active(true, particle);
       set_cell(x, y, particle);
     }
 
     void delete_particle(Particle *particle)
     {
-      particle_map.erase(particle->id);
-      active_particles.erase(particle->id);
+      log_event(EVENT_REMOVE, particle->cell, particle->velocity.length());
+      uint32_t id = particle->id;
+      set_active(false, particle);
       clear_cell(particle->cell.x, particle->cell.y);
-      delete particle;
+      particles[id] = nullptr;
+      particleCount--;
+      particle->~Particle(); // storage belongs to particleBlocks
+      freeIds.push_back(id);
     }
 
     void set_active(const bool active, Particle *particle)
     {
-      if (active)
-        active_particles.insert(particle->id);
-      else
-        active_particles.erase(particle->id);
+      int32_t &index = activeIndex[particle->id];
+      if (active && index < 0)
+      {
+        index = (int32_t)active_particles.size();
+        active_particles.push_back(particle->id);
+      }
+      else if (!active && index >= 0)
+      {
+        // swap remove, the list is unordered
+        uint32_t last = active_particles.back();
+        active_particles[index] = last;
+        activeIndex[last] = index;
+        active_particles.pop_back();
+        index = -1;
+      }
     }
   };
 
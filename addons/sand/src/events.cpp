@@ -0,0 +1,52 @@
+#include "events.h"
+#include <algorithm>
+
+using namespace godot;
+
+void EventLog::reserve(int event_capacity)
+{
+  entries.resize(std::max(event_capacity, 0));
+  count = std::min(count, (int)entries.size());
+}
+
+void EventLog::reset(int chunk_count)
+{
+  groupOf.assign((size_t)chunk_count * EVENT_TYPE_COUNT, -1);
+  count = 0;
+  dropped = 0;
+}
+
+void EventLog::take_groups(std::vector<Group> &groups)
+{
+  groups.clear();
+  lastDropped = dropped;
+  dropped = 0;
+
+  for (int i = 0; i < count; i++)
+  {
+    const Entry &e = entries[i];
+    int32_t &slot = groupOf[(size_t)e.chunk * EVENT_TYPE_COUNT + e.type];
+    if (slot < 0)
+    {
+      slot = (int32_t)groups.size();
+      groups.push_back({e.type, 0.0f, 0.0f, 0, 0.0f});
+    }
+
+    Group &g = groups[slot];
+    g.x += e.x + 0.5f;
+    g.y += e.y + 0.5f;
+    g.speed += e.speed;
+    g.count++;
+  }
+
+  // sums to means, and the lookup is cleared through the entries that set it
+  for (Group &g : groups)
+  {
+    g.x /= g.count;
+    g.y /= g.count;
+    g.speed /= g.count;
+  }
+  for (int i = 0; i < count; i++)
+    groupOf[(size_t)entries[i].chunk * EVENT_TYPE_COUNT + entries[i].type] = -1;
+  count = 0;
+}
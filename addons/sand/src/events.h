@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace godot
+{
+
+  enum SimEventType
+  {
+    EVENT_SPAWN = 0,  // a particle was created
+    EVENT_REMOVE = 1, // a particle was deleted
+    EVENT_SPLASH = 2, // falling sand entered water
+    EVENT_IMPACT = 3, // a grain or droplet hit a rigid body
+    EVENT_TYPE_COUNT = 4,
+  };
+
+  // Per tick log of particle events for audio and effects.
+  //
+  // The update path appends into a buffer allocated up front, events beyond its capacity are
+  // dropped and counted. Once per tick the log is coalesced into one group per chunk and event
+  // type, so a scene full of falling sand reports a handful of groups instead of every grain.
+  class EventLog
+  {
+  public:
+    struct Group
+    {
+      uint8_t type;
+      float x, y;   // centroid of the events, in cells
+      int count;
+      float speed;  // mean speed at the event, cells per tick
+    };
+
+    void reserve(int event_capacity);
+    // drops pending events, call after the chunk layout changed
+    void reset(int chunk_count);
+
+    inline void push(SimEventType type, int chunk, int x, int y, float speed)
+    {
+      if (count >= (int)entries.size())
+      {
+        dropped++;
+        return;
+      }
+      entries[count++] = {(uint8_t)type, chunk, x, y, speed};
+    }
+
+    bool empty() const { return count == 0; }
+    int capacity() const { return (int)entries.size(); }
+    int last_dropped() const { return lastDropped; }
+
+    // coalesces what was logged since the last call into groups and clears the log
+    void take_groups(std::vector<Group> &groups);
+
+  private:
+    struct Entry
+    {
+      uint8_t type;
+      int chunk;
+      int x, y;
+      float speed;
+    };
+
+    std::vector<Entry> entries;
+    int count = 0;
+    int dropped = 0;
+    int lastDropped = 0;
+    std::vector<int32_t> groupOf; // chunk * EVENT_TYPE_COUNT + type -> index into the output, -1 when unused
+  };
+
+} // namespace godot
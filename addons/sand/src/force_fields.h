@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <godot_cpp/variant/rect2i.hpp>
+#include <godot_cpp/variant/vector2.hpp>
+
+namespace godot
+{
+
+  enum ForceFieldType
+  {
+    FIELD_WIND = 0,   // constant acceleration inside a box
+    FIELD_VORTEX = 1, // swirl around a center, fading out towards the radius
+  };
+
+  // Persistent force fields applied to particles during the update.
+  //
+  // Like sensors, fields are indexed by the chunks they overlap so particles outside
+  // any field only pay for one empty check.
+  class ForceFieldSet
+  {
+  public:
+    void reset(int chunks_x, int chunks_y, int chunk_size);
+
+    int add_wind(const Rect2i &box, const Vector2 &acceleration);
+    int add_vortex(const Vector2 &center, float radius, float strength);
+    void remove(int id);
+    bool is_valid(int id) const { return id >= 0 && id < (int)fields.size() && fields[id].alive; }
+
+    bool affects_chunk(int chunk) const { return !chunkFields.empty() && !chunkFields[chunk].empty(); }
+    const Rect2i &get_bounds(int id) const { return fields[id].bounds; }
+    // whether the field pushes the cell at all, for a box or radius wider than the force
+    bool contains(int id, int x, int y) const { return force_at(fields[id], x, y) != Vector2(); }
+
+    // acceleration in cells per tick per second at the center of a cell
+    Vector2 sample(int chunk, int x, int y) const;
+
+  private:
+    struct ForceField
+    {
+      ForceFieldType type;
+      Rect2i bounds;
+      Vector2 acceleration; // wind
+      Vector2 center;       // vortex
+      float radius = 0.0f;
+      float strength = 0.0f;
+      bool alive = true;
+    };
+
+    std::vector<ForceField> fields;
+    std::vector<std::vector<int>> chunkFields; // chunk -> fields overlapping it
+    int chunksX = 0;
+    int chunksY = 0;
+    int chunkSize = 1;
+
+    int add(const ForceField &field);
+    static Vector2 force_at(const ForceField &f, int x, int y);
+    void index_field(int id);
+  };
+
+} // namespace godot
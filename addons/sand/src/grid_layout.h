@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace godot
+{
+
+  enum GridLayoutType
+  {
+    GRID_ROW_MAJOR = 0,
+    GRID_TILED = 1,  // 8x8 tiles in row-major order, row-major inside a tile
+    GRID_MORTON = 2, // Z-order curve over the grid padded to powers of two
+  };
+
+  // Picked at build time with `scons grid_layout=tiled|morton`, so gridIndex stays branch free
+#if defined(SAND_GRID_TILED)
+  static const GridLayoutType GRID_LAYOUT = GRID_TILED;
+#elif defined(SAND_GRID_MORTON)
+  static const GridLayoutType GRID_LAYOUT = GRID_MORTON;
+#else
+  static const GridLayoutType GRID_LAYOUT = GRID_ROW_MAJOR;
+#endif
+
+  // Maps cell coordinates to the storage index of the cell grid.
+  //
+  // Row-major puts vertical neighbours a whole row apart. The tiled and Morton layouts keep
+  // 2D neighbourhoods within a few cache lines, at the cost of padding the storage to whole
+  // tiles (or powers of two for Morton). Padding cells are never addressed.
+  struct GridLayout
+  {
+    static const int TILE_SHIFT = 3;
+    static const int TILE_SIZE = 1 << TILE_SHIFT;
+
+    int width = 0;
+    int tilesX = 0;     // tiled: tiles per row
+    int mortonBits = 0; // morton: bits interleaved from both coordinates
+    size_t size = 0;    // cells to allocate, padding included
+
+    void configure(int grid_width, int grid_height)
+    {
+      width = grid_width;
+      tilesX = (grid_width + TILE_SIZE - 1) >> TILE_SHIFT;
+      int bitsX = ceil_log2(grid_width);
+      int bitsY = ceil_log2(grid_height);
+      mortonBits = bitsX < bitsY ? bitsX : bitsY;
+
+      if (GRID_LAYOUT == GRID_TILED)
+        size = (size_t)tilesX * ((grid_height + TILE_SIZE - 1) >> TILE_SHIFT) << (2 * TILE_SHIFT);
+      else if (GRID_LAYOUT == GRID_MORTON)
+        size = (size_t)1 << (bitsX + bitsY);
+      else
+        size = (size_t)grid_width * grid_height;
+    }
+
+    inline int index(const int x, const int y) const
+    {
+      if (GRID_LAYOUT == GRID_TILED)
+      {
+        int tile = (y >> TILE_SHIFT) * tilesX + (x >> TILE_SHIFT);
+        return (tile << (2 * TILE_SHIFT)) | ((y & (TILE_SIZE - 1)) << TILE_SHIFT) | (x & (TILE_SIZE - 1));
+      }
+      else if (GRID_LAYOUT == GRID_MORTON)
+      {
+        // the longer axis keeps its high bits above the interleaved square
+        uint32_t mask = (1u << mortonBits) - 1;
+        uint32_t z = spread_bits((uint32_t)x & mask) | (spread_bits((uint32_t)y & mask) << 1);
+        uint32_t high = ((uint32_t)x >> mortonBits) | ((uint32_t)y >> mortonBits);
+        return (int)(z | (high << (2 * mortonBits)));
+      }
+      return y * width + x;
+    }
+
+    static int ceil_log2(int v)
+    {
+      int bits = 0;
+      while ((1 << bits) < v)
+        bits++;
+      return bits;
+    }
+
+    // 0b1011 -> 0b1000101
+    static inline uint32_t spread_bits(uint32_t v)
+    {
+      v &= 0xFFFF;
+      v = (v | (v << 8)) & 0x00FF00FF;
+      v = (v | (v << 4)) & 0x0F0F0F0F;
+      v = (v | (v << 2)) & 0x33333333;
+      v = (v | (v << 1)) & 0x55555555;
+      return v;
+    }
+  };
+
+} // namespace godot
@@ -0,0 +1,203 @@
+#include "liquid.h"
+#include "engine.h"
+#include <algorithm>
+
+using namespace godot;
+
+void LiquidSolver::resize(int new_width, int new_height)
+{
+  width = new_width;
+  height = new_height;
+  visited.assign((size_t)width * height, 0);
+  stamp = 0;
+}
+
+int LiquidSolver::solve(SandEngine *engine, const std::vector<Particle *> &seeds, uint32_t liquid_type)
+{
+  if (++stamp == 0)
+  {
+    std::fill(visited.begin(), visited.end(), 0);
+    stamp = 1;
+  }
+
+  int moves = 0;
+  for (Particle *seed : seeds)
+  {
+    if (visited[(size_t)seed->cell.y * width + seed->cell.x] == stamp)
+      continue; // already part of a body this solve
+
+    if (!collect_body(engine, seed->cell, liquid_type) || bodyCells < minBodyCells)
+      continue;
+
+    int moved = level_body(engine);
+    if (moved == 0 && !open)
+      sleep_body(engine);
+    else
+      rest_interior(engine);
+    moves += moved;
+  }
+  return moves;
+}
+
+bool LiquidSolver::collect_body(SandEngine *engine, const Vector2i &seed, uint32_t liquid_type)
+{
+  spans.clear();
+  surfaces.clear();
+  holes.clear();
+  stack.clear();
+  bodyCells = 0;
+  open = false;
+
+  auto is_liquid = [&](int x, int y)
+  {
+    if (x < 0 || y < 0 || x >= width || y >= height)
+      return false;
+    return engine->get_cell(x, y)->type == liquid_type && engine->get_particle(x, y) != nullptr;
+  };
+  auto add_hole = [&](int x, int y)
+  {
+    uint32_t &mark = visited[(size_t)y * width + x];
+    if (mark != stamp)
+    {
+      mark = stamp;
+      holes.push_back(Vector2i(x, y));
+    }
+  };
+
+  stack.push_back(seed);
+  while (!stack.empty())
+  {
+    Vector2i c = stack.back();
+    stack.pop_back();
+    if (visited[(size_t)c.y * width + c.x] == stamp || !is_liquid(c.x, c.y))
+      continue;
+
+    // widen to the whole run of liquid in this row
+    int x0 = c.x;
+    int x1 = c.x;
+    while (is_liquid(x0 - 1, c.y) && visited[(size_t)c.y * width + x0 - 1] != stamp)
+      x0--;
+    while (is_liquid(x1 + 1, c.y) && visited[(size_t)c.y * width + x1 + 1] != stamp)
+      x1++;
+
+    spans.push_back({c.y, x0, x1});
+    bodyCells += x1 - x0 + 1;
+    if (bodyCells > maxBodyCells)
+      return false;
+
+    for (int x = x0; x <= x1; x++)
+    {
+      visited[(size_t)c.y * width + x] = stamp;
+
+      if (is_liquid(x, c.y - 1))
+        stack.push_back(Vector2i(x, c.y - 1));
+      else if (is_free(engine, x, c.y - 1))
+      {
+        // a surface can give its cell away, and the cell above it can be filled from a higher one
+        surfaces.push_back(Vector2i(x, c.y));
+        add_hole(x, c.y - 1);
+      }
+
+      if (is_liquid(x, c.y + 1))
+        stack.push_back(Vector2i(x, c.y + 1));
+      else if (is_free(engine, x, c.y + 1))
+      {
+        add_hole(x, c.y + 1);
+        open = true;
+      }
+    }
+
+    // the run can flow sideways where there is something to rest on, otherwise it spills
+    for (int x : {x0 - 1, x1 + 1})
+    {
+      if (!is_free(engine, x, c.y))
+        continue;
+      if (is_free(engine, x, c.y + 1))
+        open = true;
+      else
+        add_hole(x, c.y);
+    }
+  }
+  return true;
+}
+
+int LiquidSolver::level_body(SandEngine *engine)
+{
+  if (surfaces.empty() || holes.empty())
+    return 0;
+
+  // highest surfaces first (smallest y), lowest holes first (largest y), ties broken on x so
+  // the pairing doesn't depend on the sort implementation
+  std::sort(surfaces.begin(), surfaces.end(), [](const Vector2i &a, const Vector2i &b)
+            { return a.y != b.y ? a.y < b.y : a.x < b.x; });
+  std::sort(holes.begin(), holes.end(), [](const Vector2i &a, const Vector2i &b)
+            { return a.y != b.y ? a.y > b.y : a.x < b.x; });
+
+  int moves = 0;
+  size_t count = std::min(surfaces.size(), holes.size());
+  for (size_t i = 0; i < count && moves < maxMovesPerBody; i++)
+  {
+    const Vector2i &from = surfaces[i];
+    const Vector2i &to = holes[i];
+    if (to.y <= from.y)
+      break; // level, moving would only shuffle cells at the same height
+
+    Particle *p = engine->get_particle(from.x, from.y);
+    if (p == nullptr || engine->get_cell(to.x, to.y)->type != 0)
+      continue;
+
+    p->set_cell(to.x, to.y);
+    p->velocity = Vector2(0, 0);
+    p->set_active(true);
+    moves++;
+  }
+  return moves;
+}
+
+bool LiquidSolver::is_free(SandEngine *engine, int x, int y) const
+{
+  if (x < 0 || y < 0 || x >= width || y >= height)
+    return false;
+  return engine->get_cell(x, y)->type == 0 && engine->get_rigid_body_at(x, y) == nullptr;
+}
+
+void LiquidSolver::rest_interior(SandEngine *engine)
+{
+  // Water::update only runs for the surface and the edges, the bulk is levelled here. A resting
+  // particle wakes when anything next to it moves (Particle::set_cell, clear_cell).
+  for (const Span &s : spans)
+  {
+    for (int x = s.x0; x <= s.x1; x++)
+    {
+      Particle *p = engine->get_particle(x, s.y);
+      if (p == nullptr || !p->active)
+        continue;
+
+      bool edge = false;
+      for (int dy = -1; dy <= 1 && !edge; dy++)
+      {
+        for (int dx = -1; dx <= 1 && !edge; dx++)
+          edge = is_free(engine, x + dx, s.y + dy);
+      }
+      if (edge)
+        continue;
+
+      p->velocity = Vector2(0, 0);
+      p->set_active(false);
+    }
+  }
+}
+
+void LiquidSolver::sleep_body(SandEngine *engine)
+{
+  for (const Span &s : spans)
+  {
+    for (int x = s.x0; x <= s.x1; x++)
+    {
+      Particle *p = engine->get_particle(x, s.y);
+      p->velocity = Vector2(0, 0);
+      if (p->active)
+        p->set_active(false);
+    }
+  }
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <godot_cpp/variant/vector2i.hpp>
+
+namespace godot
+{
+
+  class SandEngine;
+  class Particle;
+
+  // Levels connected bodies of liquid in bulk instead of one particle at a time.
+  //
+  // Each body reachable from an active liquid particle is collected as horizontal spans per
+  // row (scanline flood fill). Its free surface cells and the empty cells it could flow into
+  // (beside, below, or above a lower surface) are paired up, highest surface to lowest hole, and moved directly, which also covers
+  // communicating vessels since the fill follows the liquid through any connection. Bodies
+  // with nothing left to level and no open edge are put to sleep; in the others only the
+  // particles next to a free cell stay active, the interior waits until a neighbour moves.
+  class LiquidSolver
+  {
+  public:
+    void resize(int width, int height);
+
+    // seeds are the active particles of liquid_type this tick, returns the number of moves
+    int solve(SandEngine *engine, const std::vector<Particle *> &seeds, uint32_t liquid_type);
+
+    int minBodyCells = 32;     // smaller bodies (drops, streams) are left to the particle update
+    int maxMovesPerBody = 64;  // per tick, levelling a lake still takes a few ticks
+    int maxBodyCells = 262144; // larger bodies are skipped rather than stalling a tick
+
+  private:
+    struct Span
+    {
+      int y, x0, x1;
+    };
+
+    int width = 0;
+    int height = 0;
+    std::vector<uint32_t> visited; // per cell stamp, liquid and hole cells seen this solve
+    uint32_t stamp = 0;
+
+    std::vector<Span> spans;
+    std::vector<Vector2i> stack;
+    std::vector<Vector2i> surfaces;
+    std::vector<Vector2i> holes;
+    int bodyCells = 0;
+    bool open = false; // the body spills somewhere it can fall, so it is not settled
+
+    bool collect_body(SandEngine *engine, const Vector2i &seed, uint32_t liquid_type);
+    int level_body(SandEngine *engine);
+    void sleep_body(SandEngine *engine);
+    void rest_interior(SandEngine *engine);
+    bool is_free(SandEngine *engine, int x, int y) const;
+  };
+
+} // namespace godot
@@ -0,0 +1,143 @@
+#include "margolus.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace godot;
+
+namespace
+{
+
+  // Block layout in the table index, 2 bits per cell:
+  //   a b     bits 0-1, 2-3
+  //   c d     bits 4-5, 6-7
+  struct MargolusTable
+  {
+    // two variants that differ in which grain topples first, picked per block to avoid a directional bias
+    uint8_t next[2][256];
+
+    MargolusTable()
+    {
+      for (int variant = 0; variant < 2; variant++)
+      {
+        for (int index = 0; index < 256; index++)
+        {
+          next[variant][index] = apply_rules(index, variant);
+        }
+      }
+    }
+
+    static uint8_t apply_rules(int index, int variant)
+    {
+      uint8_t a = index & 3;
+      uint8_t b = (index >> 2) & 3;
+      uint8_t c = (index >> 4) & 3;
+      uint8_t d = (index >> 6) & 3;
+
+      const uint8_t E = MargolusGrid::EMPTY;
+      const uint8_t G = MargolusGrid::GRAIN;
+
+      // fall straight down
+      if (a == G && c == E)
+        std::swap(a, c);
+      if (b == G && d == E)
+        std::swap(b, d);
+
+      // topple diagonally off a supported cell
+      for (int i = 0; i < 2; i++)
+      {
+        bool leftFirst = (i == 0) == (variant == 0);
+        if (leftFirst && a == G && c != E && d == E)
+          std::swap(a, d);
+        else if (!leftFirst && b == G && d != E && c == E)
+          std::swap(b, c);
+      }
+
+      return (uint8_t)(a | (b << 2) | (c << 4) | (d << 6));
+    }
+  };
+
+  const MargolusTable &table()
+  {
+    static const MargolusTable instance;
+    return instance;
+  }
+
+  inline uint32_t block_variant(int x, int y, uint32_t step)
+  {
+    return ((uint32_t)x * 0x9E3779B1u ^ (uint32_t)y * 0x85EBCA77u ^ step * 0xC2B2AE3Du) >> 31;
+  }
+
+} // namespace
+
+void MargolusGrid::resize(int new_width, int new_height)
+{
+  std::vector<uint8_t> resized((size_t)new_width * new_height, EMPTY);
+  for (int y = 0; y < std::min(height, new_height); y++)
+  {
+    std::memcpy(&resized[(size_t)y * new_width], &states[(size_t)y * width], std::min(width, new_width));
+  }
+
+  width = new_width;
+  height = new_height;
+  states.swap(resized);
+  previous.assign(states.size(), EMPTY);
+}
+
+int MargolusGrid::block_rows(uint32_t step) const
+{
+  int offset = step & 1;
+  return std::max((height - offset) / 2, 0);
+}
+
+void MargolusGrid::step_block_rows(int first_row, int end_row, uint32_t step)
+{
+  const MargolusTable &lut = table();
+  int offset = step & 1;
+
+  for (int by = first_row; by < end_row; by++)
+  {
+    int y = offset + by * 2;
+    uint8_t *top = &states[(size_t)y * width];
+    uint8_t *bottom = top + width;
+
+    // columns outside the grid count as walls so edge columns still get a block every step
+    int x = offset == 0 ? 0 : -1;
+    while (x < width)
+    {
+      bool edge = x < 0 || x + 1 >= width;
+
+      // skip runs of 8 empty columns in both rows at once, most of a sparse grid
+      if (!edge && x + 8 <= width)
+      {
+        uint64_t r0, r1;
+        std::memcpy(&r0, top + x, 8);
+        std::memcpy(&r1, bottom + x, 8);
+        if ((r0 | r1) == 0)
+        {
+          x += 8;
+          continue;
+        }
+      }
+
+      uint8_t a = x >= 0 ? top[x] : WALL;
+      uint8_t b = x + 1 < width ? top[x + 1] : WALL;
+      uint8_t c = x >= 0 ? bottom[x] : WALL;
+      uint8_t d = x + 1 < width ? bottom[x + 1] : WALL;
+
+      uint32_t index = a | (b << 2) | (c << 4) | (d << 6);
+      uint8_t next = lut.next[block_variant(x, y, step)][index];
+
+      if (x >= 0)
+      {
+        top[x] = next & 3;
+        bottom[x] = (next >> 4) & 3;
+      }
+      if (x + 1 < width)
+      {
+        top[x + 1] = (next >> 2) & 3;
+        bottom[x + 1] = (next >> 6) & 3;
+      }
+      x += 2;
+    }
+  }
+}
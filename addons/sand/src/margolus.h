@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace godot
+{
+
+  // Packed byte grid stepped as a 2x2 block (Margolus neighbourhood) cellular automaton.
+  //
+  // Every step the grid is cut into 2x2 blocks, alternating between offset (0, 0) and (1, 1),
+  // and each block is replaced through a precomputed lookup table indexed by its four 2 bit
+  // cell states. Blocks never overlap within a step so any set of block rows can be stepped
+  // on its own thread.
+  class MargolusGrid
+  {
+  public:
+    static const uint8_t EMPTY = 0;
+    static const uint8_t GRAIN = 1;
+    static const uint8_t WALL = 2; // anything the automaton does not own: particles, rigid bodies
+
+    // resizes the grid keeping the overlapping region
+    void resize(int new_width, int new_height);
+
+    int get_width() const { return width; }
+    int get_height() const { return height; }
+
+    uint8_t *data() { return states.data(); }
+    const uint8_t *previous_data() const { return previous.data(); }
+
+    // copies the current states so changes can be diffed after stepping
+    void snapshot() { previous = states; }
+
+    // number of block rows for the given step, the unit of work for step_block_rows
+    int block_rows(uint32_t step) const;
+    void step_block_rows(int first_row, int end_row, uint32_t step);
+
+  private:
+    int width = 0;
+    int height = 0;
+    std::vector<uint8_t> states;
+    std::vector<uint8_t> previous;
+  };
+
+} // namespace godot
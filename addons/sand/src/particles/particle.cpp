@@ -6,7 +6,7 @@ namespace godot {
     
 
     int32_t Particle::get_cell_index() const {
-        return cell.y * engine->get_grid_width() + cell.x;
+        return engine->gridIndex(cell.x, cell.y);
     }
 
     Particle::Particle(
@@ -16,27 +16,25 @@ namespace godot {
         const Vector2& velocity,
         uint32_t type
     ) : engine(engine), cell(cell), position(position), velocity(velocity), type(type) {
-        id = PARTICLE_ID_COUNTER++;
     }
 
     void Particle::set_cell(const int x, const int y, bool clear_old_cell) {
         
         if (clear_old_cell) {
-            engine->clear_cell(cell.x, cell.y); // clear old cell
-        }
-        
-        int width = engine->get_grid_width();
-        int height = engine->get_grid_height();
-        
-        // Wake up neighbours before moving
-        for (int dy = -1; dy <= 1; dy++) {
-            for (int dx = -1; dx <= 1; dx++) {
-                int nx = cell.x + dx;
-                int ny = cell.y + dy;
-                if (nx >= 0 && nx < width && ny >= 0 && ny < height) {
-                    Particle* neighbor = engine->get_particle(nx, ny);
-                    if (neighbor != nullptr && !neighbor->active) {
-                        neighbor->set_active(true);
+            engine->clear_cell(cell.x, cell.y); // clear old cell, this also wakes its neighbours
+        } else {
+            // swaps keep the old cell occupied, wake up neighbours before moving
+            int width = engine->get_grid_width();
+            int height = engine->get_grid_height();
+            for (int dy = -1; dy <= 1; dy++) {
+                for (int dx = -1; dx <= 1; dx++) {
+                    int nx = cell.x + dx;
+                    int ny = cell.y + dy;
+                    if (nx >= 0 && nx < width && ny >= 0 && ny < height) {
+                        Particle* neighbor = engine->get_particle(nx, ny);
+                        if (neighbor != nullptr && !neighbor->active) {
+                            neighbor->set_active(true);
+                        }
                     }
                 }
             }
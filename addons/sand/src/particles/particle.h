@@ -3,14 +3,44 @@
 #include <godot_cpp/variant/vector2.hpp>
 #include <godot_cpp/variant/vector2i.hpp>
 #include <godot_cpp/variant/vector3i.hpp>
+#include <vector>
 
 namespace godot {
 
-	static int PARTICLE_ID_COUNTER = 0;
-	static float RESTING_VELOCITY = 0.1f;
+	// material ids (Particle::type, Cell::type) are below this, 0 is empty
+	static const uint32_t MATERIAL_COUNT = 16;
 
     class SandEngine; // 👈 forward declaration
 
+    // Velocities of one material's particles for the integration pre-pass, as plain float
+    // arrays so the integrate_batch kernels can run several particles per instruction
+    struct VelocityBatch {
+        std::vector<uint32_t> ids;
+        std::vector<float> vx, vy;
+        std::vector<float> fx, fy; // force field acceleration already scaled by dt
+        std::vector<float> dt;
+
+        int size() const { return (int)ids.size(); }
+
+        void clear() {
+            ids.clear();
+            vx.clear();
+            vy.clear();
+            fx.clear();
+            fy.clear();
+            dt.clear();
+        }
+
+        void push(uint32_t id, const Vector2 &velocity, const Vector2 &force, float delta) {
+            ids.push_back(id);
+            vx.push_back(velocity.x);
+            vy.push_back(velocity.y);
+            fx.push_back(force.x);
+            fy.push_back(force.y);
+            dt.push_back(delta);
+        }
+    };
+
     class Particle {
     protected:
         SandEngine* engine;
@@ -21,7 +51,9 @@ namespace godot {
         Vector2 velocity;
         Vector2 externalVelocity;
         uint32_t type;
-        int id;
+        int id = -1; // slot in the engine's particle storage, assigned on spawn
+        int lastUpdateFrame = 0;
+        int lastMoveFrame = -1; // frame of the last update, or of a column move that carried it along
         bool active = true;
         Vector3i debugColor = Vector3i(-1, -1, -1);
 
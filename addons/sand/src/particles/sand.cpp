@@ -2,20 +2,117 @@
 #include "../engine.h"
 #include <godot_cpp/variant/vector2.hpp>
 #include "water.h"
+#include "simd.h"
 
 static const godot::Vector2 MAX_VELOCITY(3, 9);
+static const float GRAVITY = 5.81f;
 
-void godot::Sand::update(double delta)
+void godot::Sand::integrate_batch(VelocityBatch &batch, float resting_velocity)
 {
-    // Gravity
-    this->velocity += Vector2(0, 5.81f) * (float)delta;
+    float *vx = batch.vx.data();
+    float *vy = batch.vy.data();
+    const float *fx = batch.fx.data();
+    const float *fy = batch.fy.data();
+    const float *dt = batch.dt.data();
+    const int count = batch.size();
+    const float rest = resting_velocity * resting_velocity;
+    int i = 0;
+
+#if defined(SAND_SIMD_AVX2)
+    const __m256 restV = _mm256_set1_ps(rest);
+    const __m256 gravityV = _mm256_set1_ps(GRAVITY);
+    const __m256 maxX = _mm256_set1_ps(MAX_VELOCITY.x);
+    const __m256 maxY = _mm256_set1_ps(MAX_VELOCITY.y);
+    const __m256 minX = _mm256_set1_ps(-MAX_VELOCITY.x);
+    const __m256 minY = _mm256_set1_ps(-MAX_VELOCITY.y);
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 x = _mm256_loadu_ps(vx + i);
+        __m256 y = _mm256_loadu_ps(vy + i);
+        __m256 moving = _mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)), restV, _CMP_GE_OQ);
+        x = _mm256_add_ps(_mm256_and_ps(x, moving), _mm256_loadu_ps(fx + i));
+        y = _mm256_add_ps(_mm256_and_ps(y, moving), _mm256_loadu_ps(fy + i));
+        y = _mm256_add_ps(y, _mm256_mul_ps(gravityV, _mm256_loadu_ps(dt + i)));
+        _mm256_storeu_ps(vx + i, _mm256_min_ps(_mm256_max_ps(x, minX), maxX));
+        _mm256_storeu_ps(vy + i, _mm256_min_ps(_mm256_max_ps(y, minY), maxY));
+    }
+#elif defined(SAND_SIMD_SSE2)
+    const __m128 restV = _mm_set1_ps(rest);
+    const __m128 gravityV = _mm_set1_ps(GRAVITY);
+    const __m128 maxX = _mm_set1_ps(MAX_VELOCITY.x);
+    const __m128 maxY = _mm_set1_ps(MAX_VELOCITY.y);
+    const __m128 minX = _mm_set1_ps(-MAX_VELOCITY.x);
+    const __m128 minY = _mm_set1_ps(-MAX_VELOCITY.y);
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(vx + i);
+        __m128 y = _mm_loadu_ps(vy + i);
+        __m128 moving = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), restV);
+        x = _mm_add_ps(_mm_and_ps(x, moving), _mm_loadu_ps(fx + i));
+        y = _mm_add_ps(_mm_and_ps(y, moving), _mm_loadu_ps(fy + i));
+        y = _mm_add_ps(y, _mm_mul_ps(gravityV, _mm_loadu_ps(dt + i)));
+        _mm_storeu_ps(vx + i, _mm_min_ps(_mm_max_ps(x, minX), maxX));
+        _mm_storeu_ps(vy + i, _mm_min_ps(_mm_max_ps(y, minY), maxY));
+    }
+#endif
 
-    this->velocity.x = CLAMP(this->velocity.x, -MAX_VELOCITY.x, MAX_VELOCITY.x);
-    this->velocity.y = CLAMP(this->velocity.y, -MAX_VELOCITY.y, MAX_VELOCITY.y);
+    for (; i < count; i++)
+    {
+        // what the previous update left below the resting velocity stops
+        bool moving = vx[i] * vx[i] + vy[i] * vy[i] >= rest;
+        float x = (moving ? vx[i] : 0.0f) + fx[i];
+        float y = (moving ? vy[i] : 0.0f) + fy[i];
+        y += GRAVITY * dt[i];
+        vx[i] = CLAMP(x, -MAX_VELOCITY.x, MAX_VELOCITY.x);
+        vy[i] = CLAMP(y, -MAX_VELOCITY.y, MAX_VELOCITY.y);
+    }
+}
+
+bool godot::Sand::is_falling_grain(int x, int y) const
+{
+    Particle *p = engine->get_particle(x, y);
+    return p != nullptr && p->type == TYPE && p->active && p->lastMoveFrame != engine->get_frame() &&
+           p->velocity.y > 0.0f && Math::abs(p->velocity.x) < 0.5f;
+}
 
+bool godot::Sand::fall_with_column(int drop)
+{
+    int x = this->cell.x;
+    int top = this->cell.y;
+    int bottom = this->cell.y;
+    while (is_falling_grain(x, top - 1))
+        top--;
+    while (is_falling_grain(x, bottom + 1))
+        bottom++;
+    if (top == bottom)
+        return false;
+
+    // only empty cells below, water still goes through the per grain swap
+    int height = engine->get_grid_height();
+    int shift = 0;
+    while (shift < drop && bottom + shift + 1 < height &&
+           engine->get_cell(x, bottom + shift + 1)->type == 0 &&
+           engine->get_rigid_body_at(x, bottom + shift + 1) == nullptr)
+        shift++;
+    if (shift == 0)
+        return false;
+
+    engine->shift_column(x, top, bottom, shift);
+    return true;
+}
+
+void godot::Sand::update(double delta)
+{
+    // a grain below or above already moved this one along with its column
+    if (this->lastMoveFrame == engine->get_frame())
+        return;
+    this->lastMoveFrame = engine->get_frame();
+
+    // gravity and the velocity clamp already ran in integrate_batch
     Vector2i from = this->cell;
 
-    Vector2 pred = Vector2(from.x, from.y) + this->velocity;
+    // far LOD chunks update less often, cover the skipped ticks in one step
+    Vector2 pred = Vector2(from.x, from.y) + this->velocity * engine->get_tick_scale(delta);
     Vector2i to = Vector2i((int)Math::round(pred.x), (int)Math::round(pred.y));
 
     int width = engine->get_grid_width();
@@ -30,46 +127,20 @@ void godot::Sand::update(double delta)
 
     if (withinRigidbody != nullptr)
     {
-
-        Vector2i searchTo = from + Vector2i(0, -50);
-        engine->for_each_along_line(from, searchTo, [&](const int &i, const Vector2i &cell)
-        {
-            if (i == 0)
-                return false; // skip the starting cell
-            if (i > 100)
-            {
-                print_line("Warning: find_last_available_cell for rigidbody exceeded 100 iterations, possible infinite loop. Returning last available cell found.");
-                return true; // limit to 100 iterations to prevent infinite loops
-            }
-
-            if (engine->get_rigid_body_at(cell.x, cell.y) == nullptr)
-            {
-                new_cell = cell;
-                return true; // stop iterating once we find a non-rigidbody cell
-            }
-            return false; // continue iterating
-        });
-
-        velocity.y = -2.0f; // give an initial upward velocity to help escape the rigidbody
-        // x away from center of rigidbody to help escape horizontally as well
-        Vector2 body_center = withinRigidbody->get_global_transform().get_origin();   
-        if (from.x < body_center.x)
-            velocity.x = -2.0f;
-        else
-            velocity.x = 2.0f;
-
-
-        // apply force to rbody from this position -> body center
-        Vector2 force_dir = (body_center - Vector2(from.x, from.y)).normalized();
-        Vector2 relPos = withinRigidbody->get_global_transform().xform_inv(Vector2(from.x, from.y));
-        withinRigidbody->apply_force(force_dir * 40.0f, relPos);
-        // ensure max vel
-        withinRigidbody->set_linear_velocity(withinRigidbody->get_linear_velocity().clamp(Vector2(-10, -10), Vector2(10, 10)));
-        withinRigidbody->set_angular_velocity(CLAMP(withinRigidbody->get_angular_velocity(), -2.0f, 2.0f));
+        // the engine's displacement pass moves cells out from under bodies before the update,
+        // anything still inside had nowhere to go this tick so it waits
+        return;
+    }
+    else if (to.x == from.x && to.y > from.y && fall_with_column(to.y - from.y))
+    {
+        // most grains of a falling run are blocked by the one below until it moved, so the
+        // run moves at once instead of one grain per update
+        return;
     }
     else
     {
 
+        Vector2i hitCell = from;
         engine->for_each_along_line(from, to, [&](const int &i, const Vector2i &cell)
         {
             if (i == 0)
@@ -81,10 +152,13 @@ void godot::Sand::update(double delta)
             }
 
             // Support swapping with liquid
-            if (
-                engine->get_rigid_body_at(cell.x, cell.y) != nullptr ||
-                engine->get_cell(cell.x, cell.y)->type != 0 &&
-                    engine->get_cell(cell.x, cell.y)->type != Water::TYPE)
+            if (engine->get_rigid_body_at(cell.x, cell.y) != nullptr)
+            {
+                hitCell = cell;
+                return true; // stop iterating
+            }
+            if (engine->get_cell(cell.x, cell.y)->type != 0 &&
+                engine->get_cell(cell.x, cell.y)->type != Water::TYPE)
             {
                 return true; // stop iterating
             }
@@ -92,11 +166,14 @@ void godot::Sand::update(double delta)
             return false; // continue iterating
         });
 
+        if (hitCell != from)
+            engine->log_event(EVENT_IMPACT, hitCell, this->velocity.length());
+
         // if blocked, try diagonal down-left/down-right
         if (new_cell == from)
         {
             int dir = this->id % 2 == 0 ? -1 : 1;
-            dir *= (frame / 10) % 2 == 0 ? -1 : 1; // alternate direction every 10 frames to reduce clumping
+            dir *= (engine->get_frame() / 10) % 2 == 0 ? -1 : 1; // alternate direction every 10 frames to reduce clumping
 
             Vector2i d1 = from + Vector2i(dir, 1);
             Vector2i d2 = from + Vector2i(-dir, 1);
@@ -132,6 +209,11 @@ void godot::Sand::update(double delta)
         // Swap with liquid if needed
         if (engine->get_cell(new_cell.x, new_cell.y)->type == Water::TYPE)
         {
+            // a grain that is already sinking has water above it, the one it swapped with
+            Cell *above = engine->get_cell(from.x, from.y - 1);
+            if (above == nullptr || above->type != Water::TYPE)
+                engine->log_event(EVENT_SPLASH, new_cell, this->velocity.length());
+
             engine->get_particle(new_cell.x, new_cell.y)->set_active(true);
             swap(engine->get_particle(new_cell.x, new_cell.y));
         }
@@ -139,10 +221,4 @@ void godot::Sand::update(double delta)
         this->set_cell(new_cell.x, new_cell.y);
         this->velocity.x *= 0.95f;
     }
-
-    if (this->velocity.length() < RESTING_VELOCITY)
-    {
-        this->velocity = Vector2(0, 0);
-        // this->set_active(false);
-    }
 }
\ No newline at end of file
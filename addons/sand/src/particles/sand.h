@@ -15,7 +15,14 @@ namespace godot
         const Vector2i &cell,
         const Vector2 &position,
         const Vector2 &velocity) : Particle(engine, cell, position, velocity, TYPE) {}
+    // resting snap, force fields, gravity and velocity clamp for a batch, before update
+    static void integrate_batch(VelocityBatch &batch, float resting_velocity);
     void update(double delta) override;
+
+  private:
+    // moves the run of falling grains this one is part of as a unit, false when it is alone or blocked
+    bool fall_with_column(int drop);
+    bool is_falling_grain(int x, int y) const;
   };
 
 }
@@ -0,0 +1,11 @@
+#pragma once
+
+// Instruction set used by the batch integration kernels. AVX2 needs `scons simd=avx2`,
+// SSE2 is always there on x86-64, anything else uses the scalar loops.
+#if defined(__AVX2__)
+#define SAND_SIMD_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SAND_SIMD_SSE2
+#include <emmintrin.h>
+#endif
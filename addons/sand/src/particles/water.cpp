@@ -2,9 +2,49 @@
 #include "../engine.h"
 #include <godot_cpp/variant/vector2.hpp>
 #include "sand.h"
+#include "simd.h"
 
 static const godot::Vector2 MAX_VELOCITY(9, 9);
-float FLOW_VISCOSITY = 15.0f;
+
+void godot::Water::integrate_batch(VelocityBatch &batch, float resting_velocity)
+{
+    float *vx = batch.vx.data();
+    float *vy = batch.vy.data();
+    const float *fx = batch.fx.data();
+    const float *fy = batch.fy.data();
+    const int count = batch.size();
+    const float rest = resting_velocity * resting_velocity;
+    int i = 0;
+
+#if defined(SAND_SIMD_AVX2)
+    const __m256 restV = _mm256_set1_ps(rest);
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 x = _mm256_loadu_ps(vx + i);
+        __m256 y = _mm256_loadu_ps(vy + i);
+        __m256 moving = _mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)), restV, _CMP_GE_OQ);
+        _mm256_storeu_ps(vx + i, _mm256_add_ps(_mm256_and_ps(x, moving), _mm256_loadu_ps(fx + i)));
+        _mm256_storeu_ps(vy + i, _mm256_add_ps(_mm256_and_ps(y, moving), _mm256_loadu_ps(fy + i)));
+    }
+#elif defined(SAND_SIMD_SSE2)
+    const __m128 restV = _mm_set1_ps(rest);
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(vx + i);
+        __m128 y = _mm_loadu_ps(vy + i);
+        __m128 moving = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), restV);
+        _mm_storeu_ps(vx + i, _mm_add_ps(_mm_and_ps(x, moving), _mm_loadu_ps(fx + i)));
+        _mm_storeu_ps(vy + i, _mm_add_ps(_mm_and_ps(y, moving), _mm_loadu_ps(fy + i)));
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        bool moving = vx[i] * vx[i] + vy[i] * vy[i] >= rest;
+        vx[i] = (moving ? vx[i] : 0.0f) + fx[i];
+        vy[i] = (moving ? vy[i] : 0.0f) + fy[i];
+    }
+}
 
 void godot::Water::update(double delta)
 {
@@ -21,41 +61,9 @@ void godot::Water::update(double delta)
 
     if (withinRigidbody != nullptr)
     {
-
-        Vector2i searchTo = from + Vector2i(0, -50);
-        engine->for_each_along_line(from, searchTo, [&](const int &i, const Vector2i &cell)
-                                    {
-                                        if (i == 0)
-                                            return false; // skip the starting cell
-                                        if (i > 100)
-                                        {
-                                            print_line("Warning: find_last_available_cell for rigidbody exceeded 100 iterations, possible infinite loop. Returning last available cell found.");
-                                            return true; // limit to 100 iterations to prevent infinite loops
-                                        }
-
-                                        if (engine->get_rigid_body_at(cell.x, cell.y) == nullptr)
-                                        {
-                                            new_cell = cell;
-                                            return true; // stop iterating once we find a non-rigidbody cell
-                                        }
-                                        return false; // continue iterating
-                                    });
-
-        velocity.y = -2.0f; // give an initial upward velocity to help escape the rigidbody
-        // x away from center of rigidbody to help escape horizontally as well
-        Vector2 body_center = withinRigidbody->get_global_transform().get_origin();
-        if (from.x < body_center.x)
-            velocity.x = -2.0f;
-        else
-            velocity.x = 2.0f;
-        
-        // apply force to rbody from this position -> body center
-        Vector2 force_dir = (body_center - Vector2(from.x, from.y)).normalized();
-        Vector2 relPos = withinRigidbody->get_global_transform().xform_inv(Vector2(from.x, from.y));
-        withinRigidbody->apply_force(force_dir * 20.0f, relPos);
-        // ensure max vel
-        withinRigidbody->set_linear_velocity(withinRigidbody->get_linear_velocity().clamp(Vector2(-10, -10), Vector2(10, 10)));
-        withinRigidbody->set_angular_velocity(CLAMP(withinRigidbody->get_angular_velocity(), -2.0f, 2.0f));
+        // the engine's displacement pass moves cells out from under bodies before the update,
+        // anything still inside had nowhere to go this tick so it waits
+        return;
     }
     else
     {
@@ -64,13 +72,13 @@ void godot::Water::update(double delta)
         if (down.x >= 0 && down.x < width && down.y >= 0 && down.y < height &&
             engine->get_cell(down.x, down.y)->type == 0)
         {
-            this->velocity.y = Math::lerp(this->velocity.y, 5.0f, float(delta) * 3.0f);
+            this->velocity.y = Math::lerp(this->velocity.y, 5.0f, MIN(float(delta) * 3.0f, 1.0f));
         }
         // if blocked, try diagonal down-left/down-right
         else
         {
             int dir = this->id % 2 == 0 ? -1 : 1;
-            // dir *= (frame / 10) % 2 == 0 ? -1 : 1; // alternate direction every 10 frames to reduce clumping
+            // dir *= (engine->get_frame() / 10) % 2 == 0 ? -1 : 1; // alternate direction every 10 frames to reduce clumping
 
             Vector2i d1 = from + Vector2i(dir, 1);
             Vector2i d2 = from + Vector2i(-dir, 1);
@@ -80,16 +88,16 @@ void godot::Water::update(double delta)
             if (d1.x >= 0 && d1.x < width && d1.y >= 0 && d1.y < height &&
                 engine->get_cell(d1.x, d1.y)->type == 0)
             {
-                this->velocity.x = Math::lerp(this->velocity.x, dir, float(delta) * FLOW_VISCOSITY);
-                this->velocity.y = Math::lerp(this->velocity.y, 0.5f, float(delta) * 3.0f);
+                this->velocity.x = Math::lerp(this->velocity.x, dir, MIN(float(delta) * engine->get_flow_viscosity(), 1.0f));
+                this->velocity.y = Math::lerp(this->velocity.y, 0.5f, MIN(float(delta) * 3.0f, 1.0f));
                 // this->velocity.y *= 0.95;
                 // this->velocity.y = CLAMP(this->velocity.y, 0.5, MAX_VELOCITY.y); // prevent water from flowing upwards too much
             }
             else if (d2.x >= 0 && d2.x < width && d2.y >= 0 && d2.y < height &&
                      engine->get_cell(d2.x, d2.y)->type == 0)
             {
-                this->velocity.x = Math::lerp(this->velocity.x, -dir, float(delta) * FLOW_VISCOSITY);
-                this->velocity.y = Math::lerp(this->velocity.y, 0.5f, float(delta) * 3.0f);
+                this->velocity.x = Math::lerp(this->velocity.x, -dir, MIN(float(delta) * engine->get_flow_viscosity(), 1.0f));
+                this->velocity.y = Math::lerp(this->velocity.y, 0.5f, MIN(float(delta) * 3.0f, 1.0f));
 
                 // this->velocity.y *= 0.95;
                 // this->velocity.y = CLAMP(this->velocity.y, 0.5, MAX_VELOCITY.y); // prevent water from flowing upwards too much
@@ -103,8 +111,8 @@ void godot::Water::update(double delta)
                 if (h1.x >= 0 && h1.x < width && h1.y >= 0 && h1.y < height &&
                     engine->get_cell(h1.x, h1.y)->type == 0)
                 {
-                    this->velocity.x = Math::lerp(this->velocity.x, dir * 2.0f, float(delta) * FLOW_VISCOSITY);
-                    this->velocity.y = Math::lerp(this->velocity.y, 0.2f, float(delta) * 20.0f);
+                    this->velocity.x = Math::lerp(this->velocity.x, dir * 2.0f, MIN(float(delta) * engine->get_flow_viscosity(), 1.0f));
+                    this->velocity.y = Math::lerp(this->velocity.y, 0.2f, MIN(float(delta) * 20.0f, 1.0f));
 
                     // this->velocity.y *= 0.8f;
                     // this->velocity.y = CLAMP(this->velocity.y, 0.5, MAX_VELOCITY.y); // prevent water from flowing upwards too much
@@ -112,8 +120,8 @@ void godot::Water::update(double delta)
                 else if (h2.x >= 0 && h2.x < width && h2.y >= 0 && h2.y < height &&
                          engine->get_cell(h2.x, h2.y)->type == 0)
                 {
-                    this->velocity.x = Math::lerp(this->velocity.x, -dir * 2.0f, float(delta) * FLOW_VISCOSITY);
-                    this->velocity.y = Math::lerp(this->velocity.y, 0.2f, float(delta) * 20.0f);
+                    this->velocity.x = Math::lerp(this->velocity.x, -dir * 2.0f, MIN(float(delta) * engine->get_flow_viscosity(), 1.0f));
+                    this->velocity.y = Math::lerp(this->velocity.y, 0.2f, MIN(float(delta) * 20.0f, 1.0f));
 
                     // this->velocity.y *= 0.8f;
                     // this->velocity.y = CLAMP(this->velocity.y, 0.5, MAX_VELOCITY.y); // prevent water from flowing upwards too much
@@ -129,13 +137,18 @@ void godot::Water::update(double delta)
         this->velocity.x = CLAMP(this->velocity.x, -MAX_VELOCITY.x, MAX_VELOCITY.x);
         this->velocity.y = CLAMP(this->velocity.y, -MAX_VELOCITY.y, MAX_VELOCITY.y);
 
-        Vector2 pred = Vector2(from.x, from.y) + this->velocity;
+        // far LOD chunks update less often, cover the skipped ticks in one step
+        Vector2 pred = Vector2(from.x, from.y) + this->velocity * engine->get_tick_scale(delta);
         Vector2i to = Vector2i((int)Math::round(pred.x), (int)Math::round(pred.y));
 
         to.x = CLAMP(to.x, 0, width - 1);
         to.y = CLAMP(to.y, 0, height - 1);
 
         new_cell = engine->find_last_available_cell(from, to);
+
+        // droplets are not stopped by bodies, they move in and the displacement pass pushes them out
+        if (new_cell != from && engine->get_rigid_body_at(new_cell.x, new_cell.y) != nullptr)
+            engine->log_event(EVENT_IMPACT, new_cell, this->velocity.length());
     }
 
     // else
@@ -148,10 +161,4 @@ void godot::Water::update(double delta)
         this->set_cell(new_cell.x, new_cell.y);
         // this->velocity.x *= 0.95f;
     }
-
-    if (this->velocity.length() < RESTING_VELOCITY)
-    {
-        this->velocity = Vector2(0, 0);
-        // this->set_active(false);
-    }
 }
\ No newline at end of file
@@ -16,6 +16,8 @@ namespace godot
         const Vector2 &position,
         const Vector2 &velocity) : Particle(engine, cell, position, velocity, TYPE) {}
 
+    // resting snap and force fields for a batch, the flow itself depends on neighbours
+    static void integrate_batch(VelocityBatch &batch, float resting_velocity);
     void update(double delta) override;
   };
 
@@ -0,0 +1,47 @@
+#include "reactions.h"
+#include <algorithm>
+
+using namespace godot;
+
+void ReactionSet::resize(size_t cell_count)
+{
+  onFrontier.assign(cell_count, 0);
+  frontier.clear();
+}
+
+int ReactionSet::add(const Rule &rule)
+{
+  if (rule.reactantA >= MATERIAL_COUNT || rule.reactantB >= MATERIAL_COUNT)
+    return -1;
+
+  rules.push_back(rule);
+  partners[rule.reactantA] |= 1u << rule.reactantB;
+  partners[rule.reactantB] |= 1u << rule.reactantA;
+  return (int)rules.size() - 1;
+}
+
+void ReactionSet::clear()
+{
+  rules.clear();
+  std::fill(std::begin(partners), std::end(partners), 0);
+  std::fill(onFrontier.begin(), onFrontier.end(), 0);
+  frontier.clear();
+}
+
+const ReactionSet::Rule *ReactionSet::find(uint32_t a, uint32_t b, bool &swapped) const
+{
+  for (const Rule &r : rules)
+  {
+    if (r.reactantA == a && r.reactantB == b)
+    {
+      swapped = false;
+      return &r;
+    }
+    if (r.reactantA == b && r.reactantB == a)
+    {
+      swapped = true;
+      return &r;
+    }
+  }
+  return nullptr;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <godot_cpp/variant/vector2i.hpp>
+#include "particles/particle.h"
+
+namespace godot
+{
+
+  // Material reactions, e.g. water + lava -> stone + steam.
+  //
+  // Rules are only evaluated on the frontier: cells where two materials that react with each
+  // other touch. The engine keeps the frontier up to date from its cell change hook, so the
+  // cost follows the length of the interfaces rather than the amount of material.
+  class ReactionSet
+  {
+  public:
+    struct Rule
+    {
+      uint32_t reactantA, reactantB;
+      uint32_t productA, productB; // what each reactant's cell turns into, 0 empties it
+      float probability;           // per tick and contact
+      uint32_t byproduct;          // spawned into a free cell next to the reaction, 0 for none
+    };
+
+    void resize(size_t cell_count);
+
+    int add(const Rule &rule);
+    void clear();
+    bool empty() const { return rules.empty(); }
+
+    bool reacts(uint32_t a, uint32_t b) const
+    {
+      return a < MATERIAL_COUNT && b < MATERIAL_COUNT && (partners[a] >> b) & 1u;
+    }
+    // rule for a touching a, with a in the rule's reactantA slot when swapped is false
+    const Rule *find(uint32_t a, uint32_t b, bool &swapped) const;
+
+    // adds a cell (by storage index) to the frontier unless it already is on it
+    void mark(int index, const Vector2i &cell)
+    {
+      if (onFrontier[index])
+        return;
+      onFrontier[index] = 1;
+      frontier.push_back(cell);
+    }
+
+    void unmark(int index) { onFrontier[index] = 0; }
+
+    // hands the frontier over for evaluation and starts an empty one, cells still touching a
+    // partner afterwards have to be marked again
+    void take_frontier(std::vector<Vector2i> &cells)
+    {
+      cells.clear();
+      cells.swap(frontier);
+    }
+    size_t frontier_size() const { return frontier.size(); }
+
+  private:
+    std::vector<Rule> rules;
+    uint32_t partners[MATERIAL_COUNT] = {}; // bit b of partners[a]: a reacts with b
+    std::vector<uint8_t> onFrontier;        // per cell, in grid storage order
+    std::vector<Vector2i> frontier;
+  };
+
+} // namespace godot
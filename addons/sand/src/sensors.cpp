@@ -0,0 +1,109 @@
+#include "sensors.h"
+#include <algorithm>
+
+using namespace godot;
+
+void SensorSet::reset(int grid_width, int grid_height, int chunks_x, int chunks_y, int chunk_size, const std::function<uint32_t(int, int)> &type_at)
+{
+  gridWidth = grid_width;
+  gridHeight = grid_height;
+  chunksX = chunks_x;
+  chunksY = chunks_y;
+  chunkSize = chunk_size;
+
+  chunkSensors.clear();
+  if (sensors.empty())
+    return;
+
+  chunkSensors.resize(chunksX * chunksY);
+  for (int id = 0; id < (int)sensors.size(); id++)
+  {
+    if (!sensors[id].alive)
+      continue;
+    sensors[id].bounds = sensors[id].area.intersection(Rect2i(0, 0, gridWidth, gridHeight));
+    index_sensor(id);
+    recount(sensors[id], type_at);
+  }
+}
+
+int SensorSet::add(const Rect2i &area, std::vector<uint8_t> &&mask, const std::function<uint32_t(int, int)> &type_at)
+{
+  Sensor s;
+  s.area = area;
+  s.bounds = area.intersection(Rect2i(0, 0, gridWidth, gridHeight));
+  s.mask = std::move(mask);
+  recount(s, type_at);
+
+  int id = (int)sensors.size();
+  sensors.push_back(std::move(s));
+  dirtyIds.reserve(sensors.size());
+
+  if (chunkSensors.empty())
+    chunkSensors.resize(chunksX * chunksY);
+  index_sensor(id);
+
+  // report the initial counts with the next batch
+  sensors[id].dirty = true;
+  dirtyIds.push_back(id);
+  return id;
+}
+
+void SensorSet::remove(int id)
+{
+  if (!is_valid(id))
+    return;
+
+  Sensor &s = sensors[id];
+  s.alive = false;
+  s.mask.clear();
+
+  for (std::vector<int> &list : chunkSensors)
+  {
+    list.erase(std::remove(list.begin(), list.end(), id), list.end());
+  }
+  dirtyIds.erase(std::remove(dirtyIds.begin(), dirtyIds.end(), id), dirtyIds.end());
+}
+
+void SensorSet::take_changes(std::vector<int> &ids)
+{
+  ids.clear();
+  for (int id : dirtyIds)
+  {
+    sensors[id].dirty = false;
+    ids.push_back(id);
+  }
+  dirtyIds.clear();
+}
+
+void SensorSet::index_sensor(int id)
+{
+  const Rect2i &b = sensors[id].bounds;
+  if (!b.has_area())
+    return;
+
+  int cx0 = b.position.x / chunkSize;
+  int cy0 = b.position.y / chunkSize;
+  int cx1 = std::min((b.position.x + b.size.x - 1) / chunkSize, chunksX - 1);
+  int cy1 = std::min((b.position.y + b.size.y - 1) / chunkSize, chunksY - 1);
+  for (int cy = cy0; cy <= cy1; cy++)
+  {
+    for (int cx = cx0; cx <= cx1; cx++)
+    {
+      chunkSensors[cy * chunksX + cx].push_back(id);
+    }
+  }
+}
+
+void SensorSet::recount(Sensor &s, const std::function<uint32_t(int, int)> &type_at)
+{
+  std::fill(std::begin(s.counts), std::end(s.counts), 0);
+  for (int y = s.bounds.position.y; y < s.bounds.position.y + s.bounds.size.y; y++)
+  {
+    for (int x = s.bounds.position.x; x < s.bounds.position.x + s.bounds.size.x; x++)
+    {
+      uint32_t type = type_at(x, y);
+      if (s.contains(x, y) && type < MATERIAL_COUNT)
+        s.counts[type]++;
+    }
+  }
+}
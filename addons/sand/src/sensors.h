@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <godot_cpp/variant/rect2i.hpp>
+#include "particles/particle.h"
+
+namespace godot
+{
+
+  // Rectangular or masked regions of the grid that keep per-material cell counts.
+  //
+  // Counts are updated incrementally from the engine's cell change hook. Sensors are indexed by
+  // the chunks they overlap, so a change in a chunk without sensors costs a single empty check.
+  class SensorSet
+  {
+  public:
+    // re-clips every sensor and rebuilds the chunk index, call after the grid (and so the chunk layout) changed
+    void reset(int grid_width, int grid_height, int chunks_x, int chunks_y, int chunk_size, const std::function<uint32_t(int, int)> &type_at);
+
+    // area is kept unclipped so a sensor reaching past the grid picks up cells when it grows,
+    // mask is one byte per cell of area (row-major), empty for a plain rectangle
+    int add(const Rect2i &area, std::vector<uint8_t> &&mask, const std::function<uint32_t(int, int)> &type_at);
+    void remove(int id);
+    bool is_valid(int id) const { return id >= 0 && id < (int)sensors.size() && sensors[id].alive; }
+
+    const int32_t *get_counts(int id) const { return sensors[id].counts; }
+
+    inline void on_cell_changed(int chunk, int x, int y, uint32_t old_type, uint32_t new_type)
+    {
+      if (chunkSensors.empty() || chunkSensors[chunk].empty())
+        return;
+
+      for (int id : chunkSensors[chunk])
+      {
+        Sensor &s = sensors[id];
+        if (!s.contains(x, y))
+          continue;
+
+        if (old_type < MATERIAL_COUNT)
+          s.counts[old_type]--;
+        if (new_type < MATERIAL_COUNT)
+          s.counts[new_type]++;
+
+        if (!s.dirty)
+        {
+          s.dirty = true;
+          dirtyIds.push_back(id);
+        }
+      }
+    }
+
+    bool has_changes() const { return !dirtyIds.empty(); }
+    // ids of sensors that changed since the last call, in the order they changed, and clears them
+    void take_changes(std::vector<int> &ids);
+
+  private:
+    struct Sensor
+    {
+      Rect2i area;   // as registered, may reach outside the grid
+      Rect2i bounds; // area clipped to the grid
+      std::vector<uint8_t> mask;
+      int32_t counts[MATERIAL_COUNT] = {};
+      bool dirty = false;
+      bool alive = true;
+
+      bool contains(int x, int y) const
+      {
+        if (x < bounds.position.x || y < bounds.position.y || x >= bounds.position.x + bounds.size.x || y >= bounds.position.y + bounds.size.y)
+          return false;
+        return mask.empty() || mask[(y - area.position.y) * area.size.x + (x - area.position.x)] != 0;
+      }
+    };
+
+    std::vector<Sensor> sensors;
+    std::vector<std::vector<int>> chunkSensors; // chunk -> sensors overlapping it
+    std::vector<int> dirtyIds;
+    int gridWidth = 0;
+    int gridHeight = 0;
+    int chunksX = 0;
+    int chunksY = 0;
+    int chunkSize = 1;
+
+    void index_sensor(int id);
+    void recount(Sensor &s, const std::function<uint32_t(int, int)> &type_at);
+  };
+
+} // namespace godot
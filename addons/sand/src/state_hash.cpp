@@ -0,0 +1,26 @@
+#include "state_hash.h"
+
+using namespace godot;
+
+void StateHash::reset(int grid_width, int grid_height, int chunks_x, int chunks_y, int chunk_size, const std::function<uint32_t(int, int)> &type_at)
+{
+  chunkHashes.assign(chunks_x * chunks_y, 0);
+  for (int y = 0; y < grid_height; y++)
+  {
+    for (int x = 0; x < grid_width; x++)
+    {
+      uint32_t type = type_at(x, y);
+      if (type != 0)
+        chunkHashes[(y / chunk_size) * chunks_x + x / chunk_size] ^= key(x, y, type);
+    }
+  }
+}
+
+uint64_t StateHash::world() const
+{
+  // keys already depend on the cell position, so the chunk hashes XOR together
+  uint64_t hash = 0;
+  for (uint64_t h : chunkHashes)
+    hash ^= h;
+  return hash;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace godot
+{
+
+  // Per-chunk hashes of the cell grid for lockstep desync detection.
+  //
+  // A chunk's hash is the XOR of a Zobrist key per non-empty cell, derived from its position and
+  // material, so the engine's cell change hook keeps it current with two key lookups. The world
+  // hash combines the chunk hashes, comparing chunk hashes between peers finds where they differ.
+  class StateHash
+  {
+  public:
+    // rehashes every cell, call after the grid (and so the chunk layout) changed
+    void reset(int grid_width, int grid_height, int chunks_x, int chunks_y, int chunk_size, const std::function<uint32_t(int, int)> &type_at);
+
+    inline void on_cell_changed(int chunk, int x, int y, uint32_t old_type, uint32_t new_type)
+    {
+      chunkHashes[chunk] ^= key(x, y, old_type) ^ key(x, y, new_type);
+    }
+
+    uint64_t world() const;
+    const std::vector<uint64_t> &chunks() const { return chunkHashes; }
+
+    // splitmix64 finalizer
+    static inline uint64_t mix(uint64_t z)
+    {
+      z += 0x9E3779B97F4A7C15ull;
+      z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+      z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+      return z ^ (z >> 31);
+    }
+
+    // computed on the fly instead of a key table per cell and material
+    static inline uint64_t key(int x, int y, uint32_t type)
+    {
+      if (type == 0)
+        return 0;
+      return mix(((uint64_t)(uint32_t)y << 40) ^ ((uint64_t)(uint32_t)x << 16) ^ type);
+    }
+
+  private:
+    std::vector<uint64_t> chunkHashes;
+  };
+
+} // namespace godot
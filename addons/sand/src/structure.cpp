@@ -0,0 +1,281 @@
+#include "structure.h"
+#include "engine.h"
+#include <algorithm>
+
+using namespace godot;
+
+void StructureGraph::reset(int grid_width, int grid_height, int chunks_x, int chunks_y, int chunk_size)
+{
+  width = grid_width;
+  height = grid_height;
+  chunksX = chunks_x;
+  chunksY = chunks_y;
+  chunkSize = chunk_size;
+
+  chunks.assign(chunksX * chunksY, ChunkLabels());
+  for (ChunkLabels &c : chunks)
+    c.label.assign(chunkSize * chunkSize, 0);
+
+  // everything gets labelled once, later only what changes
+  dirty.assign(chunksX * chunksY, 1);
+  anyDirty = true;
+  labelOnly = true;
+}
+
+void StructureGraph::update(SandEngine *engine, std::vector<std::vector<Vector2i>> &detached, int min_cells, int max_cells)
+{
+  detached.clear();
+  if (!anyDirty)
+    return;
+
+  for (int cy = 0; cy < chunksY; cy++)
+  {
+    for (int cx = 0; cx < chunksX; cx++)
+    {
+      if (dirty[cy * chunksX + cx])
+        label_chunk(engine, cx, cy);
+    }
+  }
+
+  // border links of dirty chunks, including the borders shared with their left and top neighbours
+  for (int cy = 0; cy < chunksY; cy++)
+  {
+    for (int cx = 0; cx < chunksX; cx++)
+    {
+      int c = cy * chunksX + cx;
+      bool rightDirty = cx + 1 < chunksX && dirty[c + 1];
+      bool downDirty = cy + 1 < chunksY && dirty[c + chunksX];
+      if (dirty[c] || rightDirty)
+        link_right(cx, cy);
+      if (dirty[c] || downDirty)
+        link_down(cx, cy);
+    }
+  }
+
+  // global ids and union-find over all components
+  int total = 0;
+  for (ChunkLabels &c : chunks)
+  {
+    c.base = total;
+    total += c.count;
+  }
+  parent.resize(total);
+  for (int i = 0; i < total; i++)
+    parent[i] = i;
+
+  for (int cy = 0; cy < chunksY; cy++)
+  {
+    for (int cx = 0; cx < chunksX; cx++)
+    {
+      const ChunkLabels &c = chunks[cy * chunksX + cx];
+      for (const std::pair<uint16_t, uint16_t> &link : c.right)
+        unite(c.base + link.first - 1, chunks[cy * chunksX + cx + 1].base + link.second - 1);
+      for (const std::pair<uint16_t, uint16_t> &link : c.down)
+        unite(c.base + link.first - 1, chunks[(cy + 1) * chunksX + cx].base + link.second - 1);
+    }
+  }
+
+  rootSupported.assign(total, 0);
+  rootCells.assign(total, 0);
+  for (const ChunkLabels &c : chunks)
+  {
+    for (int l = 0; l < c.count; l++)
+    {
+      int root = find(c.base + l);
+      rootSupported[root] |= c.supported[l];
+      rootCells[root] += c.cellCount[l];
+    }
+  }
+
+  // a piece can only have lost its support next to where something changed
+  candidate.assign(total, 0);
+  bool anyCandidate = false;
+  for (int cy = 0; cy < chunksY && !labelOnly; cy++)
+  {
+    for (int cx = 0; cx < chunksX; cx++)
+    {
+      if (!dirty[cy * chunksX + cx])
+        continue;
+      for (int ny = std::max(cy - 1, 0); ny <= std::min(cy + 1, chunksY - 1); ny++)
+      {
+        for (int nx = std::max(cx - 1, 0); nx <= std::min(cx + 1, chunksX - 1); nx++)
+        {
+          const ChunkLabels &n = chunks[ny * chunksX + nx];
+          for (int l = 0; l < n.count; l++)
+          {
+            int root = find(n.base + l);
+            if (!rootSupported[root] && rootCells[root] >= min_cells && rootCells[root] <= max_cells && !candidate[root])
+            {
+              candidate[root] = 1;
+              anyCandidate = true;
+            }
+          }
+        }
+      }
+    }
+  }
+
+  std::fill(dirty.begin(), dirty.end(), 0);
+  anyDirty = false;
+  labelOnly = false;
+  if (!anyCandidate)
+    return;
+
+  // only the chunks holding part of a candidate are scanned, found per component not per cell
+  candidateChunks.clear();
+  for (int ci = 0; ci < (int)chunks.size(); ci++)
+  {
+    const ChunkLabels &c = chunks[ci];
+    for (int l = 0; l < c.count; l++)
+    {
+      if (candidate[find(c.base + l)])
+      {
+        candidateChunks.push_back(ci);
+        break;
+      }
+    }
+  }
+
+  // gather the cells of each unsupported component
+  std::vector<int> slot(total, -1);
+  for (int ci : candidateChunks)
+  {
+    int cx = ci % chunksX;
+    int cy = ci / chunksX;
+    const ChunkLabels &c = chunks[ci];
+    for (int ly = 0; ly < chunkSize; ly++)
+    {
+      for (int lx = 0; lx < chunkSize; lx++)
+      {
+        uint16_t l = c.label[ly * chunkSize + lx];
+        if (l == 0)
+          continue;
+        int root = find(c.base + l - 1);
+        if (!candidate[root])
+          continue;
+        if (slot[root] < 0)
+        {
+          slot[root] = (int)detached.size();
+          detached.emplace_back();
+        }
+        detached[slot[root]].push_back(Vector2i(cx * chunkSize + lx, cy * chunkSize + ly));
+      }
+    }
+  }
+}
+
+void StructureGraph::label_chunk(SandEngine *engine, int cx, int cy)
+{
+  ChunkLabels &c = chunks[cy * chunksX + cx];
+  std::fill(c.label.begin(), c.label.end(), 0);
+  c.supported.clear();
+  c.cellCount.clear();
+  c.count = 0;
+
+  int x0 = cx * chunkSize;
+  int y0 = cy * chunkSize;
+  int w = std::min(chunkSize, width - x0);
+  int h = std::min(chunkSize, height - y0);
+
+  for (int sy = 0; sy < h; sy++)
+  {
+    for (int sx = 0; sx < w; sx++)
+    {
+      if (c.label[sy * chunkSize + sx] != 0 || !is_solid(engine->get_cell(x0 + sx, y0 + sy)->type))
+        continue;
+
+      uint16_t l = (uint16_t)++c.count;
+      uint8_t supported = 0;
+      int cells = 0;
+      c.label[sy * chunkSize + sx] = l;
+      stack.clear();
+      stack.push_back(Vector2i(sx, sy));
+      while (!stack.empty())
+      {
+        Vector2i p = stack.back();
+        stack.pop_back();
+        cells++;
+
+        int gx = x0 + p.x;
+        int gy = y0 + p.y;
+        uint32_t type = engine->get_cell(gx, gy)->type;
+        if (gy == height - 1 || (type < 32 && (anchorMask >> type) & 1u))
+          supported = 1;
+        else if (is_support(engine->get_cell(gx, gy + 1)->type))
+          supported = 1; // resting on sand and the like
+
+        static const int dx[4] = {1, -1, 0, 0};
+        static const int dy[4] = {0, 0, 1, -1};
+        for (int k = 0; k < 4; k++)
+        {
+          int nx = p.x + dx[k];
+          int ny = p.y + dy[k];
+          if (nx < 0 || ny < 0 || nx >= w || ny >= h)
+            continue;
+          uint16_t &nl = c.label[ny * chunkSize + nx];
+          if (nl == 0 && is_solid(engine->get_cell(x0 + nx, y0 + ny)->type))
+          {
+            nl = l;
+            stack.push_back(Vector2i(nx, ny));
+          }
+        }
+      }
+      c.supported.push_back(supported);
+      c.cellCount.push_back(cells);
+    }
+  }
+}
+
+void StructureGraph::link_right(int cx, int cy)
+{
+  ChunkLabels &c = chunks[cy * chunksX + cx];
+  c.right.clear();
+  if (cx + 1 >= chunksX)
+    return;
+
+  const ChunkLabels &n = chunks[cy * chunksX + cx + 1];
+  int h = std::min(chunkSize, height - cy * chunkSize);
+  for (int ly = 0; ly < h; ly++)
+  {
+    uint16_t a = c.label[ly * chunkSize + chunkSize - 1];
+    uint16_t b = n.label[ly * chunkSize];
+    if (a != 0 && b != 0 && (c.right.empty() || c.right.back() != std::make_pair(a, b)))
+      c.right.push_back(std::make_pair(a, b));
+  }
+}
+
+void StructureGraph::link_down(int cx, int cy)
+{
+  ChunkLabels &c = chunks[cy * chunksX + cx];
+  c.down.clear();
+  if (cy + 1 >= chunksY)
+    return;
+
+  const ChunkLabels &n = chunks[(cy + 1) * chunksX + cx];
+  int w = std::min(chunkSize, width - cx * chunkSize);
+  for (int lx = 0; lx < w; lx++)
+  {
+    uint16_t a = c.label[(chunkSize - 1) * chunkSize + lx];
+    uint16_t b = n.label[lx];
+    if (a != 0 && b != 0 && (c.down.empty() || c.down.back() != std::make_pair(a, b)))
+      c.down.push_back(std::make_pair(a, b));
+  }
+}
+
+int StructureGraph::find(int id)
+{
+  while (parent[id] != id)
+  {
+    parent[id] = parent[parent[id]];
+    id = parent[id];
+  }
+  return id;
+}
+
+void StructureGraph::unite(int a, int b)
+{
+  a = find(a);
+  b = find(b);
+  if (a != b)
+    parent[std::max(a, b)] = std::min(a, b);
+}
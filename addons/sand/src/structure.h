@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <godot_cpp/variant/vector2i.hpp>
+
+namespace godot
+{
+
+  class SandEngine;
+
+  // Connectivity of static solid cells (terrain), used to find pieces that lost their support.
+  //
+  // Each chunk keeps its own component labels, and components of neighbouring chunks are linked
+  // through the cells along their shared border. Only chunks whose solids changed are relabelled;
+  // joining the chunks runs a union-find over components and border links, never over cells.
+  class StructureGraph
+  {
+  public:
+    uint32_t solidMask = 0;   // materials that form structures
+    uint32_t anchorMask = 0;  // structure materials that never fall
+    uint32_t supportMask = 0; // other materials a structure can rest on
+
+    void reset(int grid_width, int grid_height, int chunks_x, int chunks_y, int chunk_size);
+
+    bool is_solid(uint32_t type) const { return type < 32 && (solidMask >> type) & 1u; }
+    bool is_support(uint32_t type) const { return type < 32 && (supportMask >> type) & 1u; }
+
+    void mark_dirty(int chunk) { dirty[chunk] = 1; anyDirty = true; }
+    bool has_dirty() const { return anyDirty; }
+
+    // Relabels the dirty chunks and returns the cells of every unsupported component that has
+    // a part in or next to them. Components outside [min_cells, max_cells] are left in place.
+    // The first update after a reset only labels, whatever floats in the initial grid stays.
+    void update(SandEngine *engine, std::vector<std::vector<Vector2i>> &detached, int min_cells, int max_cells);
+
+  private:
+    struct ChunkLabels
+    {
+      std::vector<uint16_t> label; // per cell of the chunk, 0 when not solid
+      std::vector<uint8_t> supported; // per component (label - 1)
+      std::vector<int> cellCount;     // per component
+      int count = 0;
+      int base = 0; // first global component id, assigned per update
+      // pairs of (label here, label in the neighbour) touching across the right and bottom borders
+      std::vector<std::pair<uint16_t, uint16_t>> right;
+      std::vector<std::pair<uint16_t, uint16_t>> down;
+    };
+
+    int width = 0;
+    int height = 0;
+    int chunksX = 0;
+    int chunksY = 0;
+    int chunkSize = 1;
+    std::vector<ChunkLabels> chunks;
+    std::vector<uint8_t> dirty;
+    bool anyDirty = false;
+    bool labelOnly = false;
+
+    std::vector<int> parent; // union-find over global component ids
+    std::vector<uint8_t> rootSupported;
+    std::vector<int> rootCells;
+    std::vector<uint8_t> candidate;
+    std::vector<int> candidateChunks;
+    std::vector<Vector2i> stack;
+
+    void label_chunk(SandEngine *engine, int cx, int cy);
+    void link_right(int cx, int cy);
+    void link_down(int cx, int cy);
+    int find(int id);
+    void unite(int a, int b);
+  };
+
+} // namespace godot
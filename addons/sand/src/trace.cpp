@@ -0,0 +1,114 @@
+#include "trace.h"
+#include <godot_cpp/classes/file_access.hpp>
+#include <godot_cpp/variant/utility_functions.hpp>
+#include <set>
+#include <string>
+
+using namespace godot;
+
+Tracer::Tracer()
+{
+  epoch = std::chrono::steady_clock::now();
+}
+
+uint32_t Tracer::current_thread_id()
+{
+  static std::atomic<uint32_t> next_id{1};
+  thread_local uint32_t id = next_id.fetch_add(1);
+  return id;
+}
+
+int64_t Tracer::now_usec() const
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+void Tracer::capture(const String &path, int first_frame, int frame_count, uint64_t process_id)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  this->path = path;
+  this->firstFrame = first_frame;
+  this->lastFrame = first_frame + (frame_count > 0 ? frame_count : 1) - 1;
+  this->processId = process_id;
+  // reserve up front so recording a capture does not allocate mid-tick
+  events.clear();
+  events.reserve(1 << 16);
+}
+
+void Tracer::begin_frame(int frame)
+{
+  if (!is_armed())
+    return;
+
+  if (!is_recording() && frame >= firstFrame && frame <= lastFrame)
+  {
+    epoch = std::chrono::steady_clock::now();
+    recording.store(true);
+  }
+  else if (!is_recording() && frame > lastFrame)
+  {
+    // the range was missed entirely, disarm instead of waiting forever
+    firstFrame = -1;
+    lastFrame = -1;
+  }
+  else if (is_recording() && frame > lastFrame)
+  {
+    recording.store(false);
+    write_file();
+    firstFrame = -1;
+    lastFrame = -1;
+  }
+}
+
+void Tracer::record(const char *name, const char *category, int64_t start_usec, int64_t end_usec, int64_t arg)
+{
+  TraceEvent e{name, category, start_usec, end_usec - start_usec, current_thread_id(), arg};
+  std::lock_guard<std::mutex> lock(mutex);
+  events.push_back(e);
+}
+
+void Tracer::write_file()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  std::string pid = std::to_string(processId);
+  std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  json += "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" + pid + ",\"tid\":0,\"args\":{\"name\":\"SandEngine " + pid + "\"}}";
+
+  std::set<uint32_t> threads;
+  for (const TraceEvent &e : events)
+  {
+    threads.insert(e.threadId);
+
+    json += ",\n{\"name\":\"";
+    json += e.name;
+    json += "\",\"cat\":\"";
+    json += e.category;
+    json += "\",\"ph\":\"X\",\"ts\":" + std::to_string(e.startUsec);
+    json += ",\"dur\":" + std::to_string(e.durationUsec);
+    json += ",\"pid\":" + pid + ",\"tid\":" + std::to_string(e.threadId);
+    if (e.arg >= 0)
+      json += ",\"args\":{\"value\":" + std::to_string(e.arg) + "}";
+    json += "}";
+  }
+
+  // name thread lanes so Perfetto shows "thread 1", "thread 2"... instead of raw ids
+  for (uint32_t tid : threads)
+  {
+    json += ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" + pid + ",\"tid\":" + std::to_string(tid);
+    json += ",\"args\":{\"name\":\"thread " + std::to_string(tid) + "\"}}";
+  }
+  json += "\n]}\n";
+
+  Ref<FileAccess> file = FileAccess::open(path, FileAccess::WRITE);
+  if (file.is_null())
+  {
+    UtilityFunctions::print("Trace capture: could not open ", path, " for writing");
+    return;
+  }
+  file->store_string(String::utf8(json.c_str(), (int)json.size()));
+  file->close();
+
+  UtilityFunctions::print("Trace capture: wrote ", (int64_t)events.size(), " zones to ", path);
+  events.clear();
+}
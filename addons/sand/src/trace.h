@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include <godot_cpp/variant/string.hpp>
+
+// Timeline capture for the simulation tick, written out as Chrome trace-event JSON
+// (open the file in ui.perfetto.dev or chrome://tracing).
+//
+// Zones are only compiled in when building with `scons trace=yes` (SAND_TRACE_ENABLED),
+// otherwise the SAND_TRACE_* macros expand to nothing and cost nothing.
+namespace godot
+{
+
+  struct TraceEvent
+  {
+    const char *name;
+    const char *category;
+    int64_t startUsec;
+    int64_t durationUsec;
+    uint32_t threadId;
+    int64_t arg; // shown as args.value, -1 = none
+  };
+
+  class Tracer
+  {
+  private:
+    std::mutex mutex;
+    std::vector<TraceEvent> events;
+    std::atomic<bool> recording{false};
+    std::chrono::steady_clock::time_point epoch;
+
+    String path;
+    int firstFrame = -1;
+    int lastFrame = -1;
+    uint64_t processId = 0;
+
+    void write_file();
+
+  public:
+    Tracer();
+
+    // arm a capture of frames [first_frame, first_frame + frame_count), written to path when the range ends
+    void capture(const String &path, int first_frame, int frame_count, uint64_t process_id);
+    // called at the start of every tick, starts and stops recording based on the requested range
+    void begin_frame(int frame);
+
+    bool is_recording() const { return recording.load(std::memory_order_relaxed); }
+    bool is_armed() const { return firstFrame >= 0; }
+
+    int64_t now_usec() const;
+    void record(const char *name, const char *category, int64_t start_usec, int64_t end_usec, int64_t arg);
+
+    // stable small id for the calling thread, used as the trace "tid"
+    static uint32_t current_thread_id();
+  };
+
+  class TraceZone
+  {
+  private:
+    Tracer *tracer;
+    const char *name;
+    const char *category;
+    int64_t arg;
+    int64_t start;
+
+  public:
+    TraceZone(Tracer &tracer, const char *name, const char *category = "sim", int64_t arg = -1)
+        : tracer(tracer.is_recording() ? &tracer : nullptr), name(name), category(category), arg(arg)
+    {
+      start = this->tracer != nullptr ? tracer.now_usec() : 0;
+    }
+
+    ~TraceZone()
+    {
+      if (tracer != nullptr)
+        tracer->record(name, category, start, tracer->now_usec(), arg);
+    }
+
+    TraceZone(const TraceZone &) = delete;
+    TraceZone &operator=(const TraceZone &) = delete;
+  };
+
+} // namespace godot
+
+#define SAND_TRACE_CONCAT_INNER(a, b) a##b
+#define SAND_TRACE_CONCAT(a, b) SAND_TRACE_CONCAT_INNER(a, b)
+
+#ifdef SAND_TRACE_ENABLED
+// SAND_TRACE_ZONE(tracer, "name") times the enclosing scope
+#define SAND_TRACE_ZONE(tracer, name) ::godot::TraceZone SAND_TRACE_CONCAT(sand_trace_zone_, __LINE__)(tracer, name)
+// SAND_TRACE_ZONE_ARG(tracer, "name", "category", value) also tags the zone with an integer (frame, chunk, worker index...)
+#define SAND_TRACE_ZONE_ARG(tracer, name, category, value) ::godot::TraceZone SAND_TRACE_CONCAT(sand_trace_zone_, __LINE__)(tracer, name, category, value)
+#else
+#define SAND_TRACE_ZONE(tracer, name)
+#define SAND_TRACE_ZONE_ARG(tracer, name, category, value)
+#endif
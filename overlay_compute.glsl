@@ -14,7 +14,7 @@ layout(set = 0, binding = 1) uniform Params {
     int camX;
     int camY;
     int debugMode;
-    int padding; // padding to 32 bytes for std140 layout
+    int gridLayout; // SandEngine.get_grid_layout(), also pads to 32 bytes for std140 layout
 } params;
 
 struct Cell {
@@ -27,6 +27,36 @@ layout (set = 0, binding = 2) buffer Cells {
     Cell cells[];
 };
 
+int ceil_log2(int v) {
+    return v <= 1 ? 0 : findMSB(v - 1) + 1;
+}
+
+uint spread_bits(uint v) {
+    v &= 0xFFFFu;
+    v = (v | (v << 8)) & 0x00FF00FFu;
+    v = (v | (v << 4)) & 0x0F0F0F0Fu;
+    v = (v | (v << 2)) & 0x33333333u;
+    v = (v | (v << 1)) & 0x55555555u;
+    return v;
+}
+
+// matches GridLayout::index in src/grid_layout.h
+int grid_index(ivec2 p) {
+    if (params.gridLayout == 1) { // 8x8 tiles
+        int tilesX = (params.gridWidth + 7) >> 3;
+        int tile = (p.y >> 3) * tilesX + (p.x >> 3);
+        return (tile << 6) | ((p.y & 7) << 3) | (p.x & 7);
+    }
+    if (params.gridLayout == 2) { // morton
+        int bits = min(ceil_log2(params.gridWidth), ceil_log2(params.gridHeight));
+        uint mask = (1u << bits) - 1u;
+        uint z = spread_bits(uint(p.x) & mask) | (spread_bits(uint(p.y) & mask) << 1);
+        uint high = (uint(p.x) >> bits) | (uint(p.y) >> bits);
+        return int(z | (high << (2 * bits)));
+    }
+    return p.y * params.gridWidth + p.x;
+}
+
 void main() {
 	ivec2 px = ivec2(gl_GlobalInvocationID.xy);
     ivec2 gridPos = px + ivec2(params.camX, params.camY);
@@ -40,7 +70,7 @@ void main() {
     }
 
     // int idx = px.y * params.screenWidth + px.x;
-    int idx = gridPos.y * params.gridWidth + gridPos.x;
+    int idx = grid_index(gridPos);
     Cell cell = cells[idx];
 
     if (params.debugMode != 0) {
@@ -61,6 +91,11 @@ void main() {
       // light blue for foam
         imageStore(out_img, px, vec4(0.5, 0.5, 1.0, 0.6)); // light blue for foam
     }
+    else if (cell.type > 3) {
+        // static materials from reactions, shaded per type so they can be told apart
+        float shade = 0.35 + 0.05 * float(cell.type % 8);
+        imageStore(out_img, px, vec4(shade, shade, shade, 1.0));
+    }
     else {
         imageStore(out_img, px, vec4(0.0, 0.0, 0.0, 0.0)); // black for empty
     }
@@ -27,6 +27,8 @@ var uniform_set_rid: RID
 var out_tex: Texture2DRD
 
 var param_buffer: RID
+var image_uniform: RDUniform
+var param_uniform: RDUniform
 var bodies: Array[RigidBody2D] = []
 
 var W := 124
@@ -93,7 +95,7 @@ func _ready():
 
 
 	# 300 x 300 is grid width, W, H is screen size
-	var param_buf := PackedInt32Array([W, H, sandEngine.get_grid_width(), sandEngine.get_grid_height(), int(camera.position.x), int(camera.position.y), debugOption, 0]).to_byte_array()
+	var param_buf := PackedInt32Array([W, H, sandEngine.get_grid_width(), sandEngine.get_grid_height(), int(camera.position.x), int(camera.position.y), debugOption, sandEngine.get_grid_layout()]).to_byte_array()
 
 	var p := rd.uniform_buffer_create(param_buf.size(), param_buf)
 	
@@ -104,12 +106,12 @@ func _ready():
 
 	param_buffer = p
 
-	var storage_buf := RDUniform.new()
-	storage_buf.uniform_type = RenderingDevice.UNIFORM_TYPE_STORAGE_BUFFER
-	storage_buf.binding = 2
-	storage_buf.add_id(sandEngine.get_ssbo_rid())
+	image_uniform = u
+	param_uniform = param_ub
+	create_uniform_set()
 
-	uniform_set_rid = rd.uniform_set_create([u, param_ub, storage_buf], shader_rid, 0)
+	# the engine recreates its ssbo when the grid is resized
+	sandEngine.grid_resized.connect(create_uniform_set)
 
 
 	# --- Wrap RID for UI display ---
@@ -121,6 +123,14 @@ func _ready():
 
 	initialized = true
 
+func create_uniform_set():
+	var storage_buf := RDUniform.new()
+	storage_buf.uniform_type = RenderingDevice.UNIFORM_TYPE_STORAGE_BUFFER
+	storage_buf.binding = 2
+	storage_buf.add_id(sandEngine.get_ssbo_rid())
+
+	uniform_set_rid = rd.uniform_set_create([image_uniform, param_uniform, storage_buf], shader_rid, 0)
+
 func _process(_dt):
 	if not initialized:
 		return
@@ -129,7 +139,9 @@ func _process(_dt):
 
 	# Update uniform buffer with camera position
 	var top_left := camera.get_screen_center_position() - Vector2(W, H) * 0.5
-	var param_buf := PackedInt32Array([W, H, sandEngine.get_grid_width(), sandEngine.get_grid_height(), int(floor(top_left.x)), int(floor(top_left.y)), debugOption, 0]).to_byte_array()
+	# the engine simulates regions away from the view at a lower rate
+	sandEngine.set_view_rect(Rect2i(Vector2i(floor(top_left.x), floor(top_left.y)), Vector2i(W, H)))
+	var param_buf := PackedInt32Array([W, H, sandEngine.get_grid_width(), sandEngine.get_grid_height(), int(floor(top_left.x)), int(floor(top_left.y)), debugOption, sandEngine.get_grid_layout()]).to_byte_array()
 	rd.buffer_update(param_buffer, 0, param_buf.size(), param_buf)
 	# Dispatch compute every frame
 	var cl := rd.compute_list_begin()
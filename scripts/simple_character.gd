@@ -3,6 +3,12 @@ extends CharacterBody2D
 @export var speed := 120.0
 @export var jump_velocity := -300.0
 @export var gravity := 900.0
+# when set the character also collides with the sand grid
+@export var sand_engine: SandEngine
+@export var box_size := Vector2(8, 16)
+@export var max_step := 3
+
+var on_sand := false
 
 func _physics_process(delta):
 	if not is_on_floor():
@@ -16,7 +22,37 @@ func _physics_process(delta):
 
 	velocity.x = direction * speed
 
-	if Input.is_key_pressed(KEY_W) and is_on_floor():
+	if Input.is_key_pressed(KEY_W) and (is_on_floor() or on_sand):
 		velocity.y = jump_velocity
 
+	if sand_engine:
+		move_on_sand(direction, delta)
+
 	move_and_slide()
+
+# Sweeps the motion against the sand grid first, move_and_slide then only gets to move as far
+# as the grid allowed, so physics bodies and sand both block the character
+func move_on_sand(direction: int, delta: float):
+	var box := Rect2(sand_engine.to_local(global_position) - box_size * 0.5, box_size)
+
+	# nothing to collide with off the grid, leave the motion to move_and_slide
+	if not Rect2(0, 0, sand_engine.grid_width, sand_engine.grid_height).intersects(box):
+		on_sand = false
+		return
+
+	# walk up small ledges instead of stopping at them
+	if direction != 0:
+		var step: int = sand_engine.probe_step(box, direction, max_step)
+		if step > 0:
+			box.position.y -= step
+
+	var result: Dictionary = sand_engine.move_and_collide(box, velocity * delta)
+	var travel: Vector2 = result["travel"]
+	var end: Vector2 = result["position"]
+	var ground: int = sand_engine.get_ground_height(int(end.x), int(end.x + box_size.x - 1), int(end.y + box_size.y), 0)
+	on_sand = ground >= 0
+
+	# step up and pushes out of material are applied directly, the travel through move_and_slide
+	var start: Vector2 = result["position"] - travel
+	global_position = sand_engine.to_global(start + box_size * 0.5)
+	velocity = travel / delta